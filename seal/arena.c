@@ -0,0 +1,135 @@
+#include "shell.h"
+
+/*
+ * Arena (bump) allocator.
+ *
+ * Everything built for one command line - the token array, token strings
+ * and the Pipeline/Command/Redirection structures - is carved out of one
+ * arena and released together by arena_reset(). After a reset the arena
+ * keeps a single chunk big enough for the largest line seen so far, so in
+ * steady state a line costs no malloc()/free() calls at all.
+ */
+
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGN 16
+
+/* Don't hold on to more than this between lines */
+#define ARENA_KEEP_MAX (1024 * 1024)
+
+struct ArenaChunk {
+  struct ArenaChunk *next; /* Previously filled chunk */
+  size_t size;             /* Usable bytes in data */
+  size_t used;             /* Bytes handed out */
+  char data[];
+};
+
+static ArenaChunk *new_chunk(Arena *a, size_t size) {
+  ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+  if (!chunk) {
+    perror("malloc");
+    return NULL;
+  }
+
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->next = NULL;
+  a->stats.chunk_mallocs++;
+  return chunk;
+}
+
+void arena_init(Arena *a) { memset(a, 0, sizeof(Arena)); }
+
+void *arena_alloc(Arena *a, size_t size) {
+  ArenaChunk *chunk = a->head;
+  size_t offset;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (!chunk || chunk->size - chunk->used < size) {
+    size_t chunk_size = ARENA_CHUNK_SIZE;
+
+    /* Grow geometrically so long lines need few chunks */
+    if (chunk && chunk->size * 2 > chunk_size)
+      chunk_size = chunk->size * 2;
+    if (size > chunk_size)
+      chunk_size = size;
+
+    ArenaChunk *fresh = new_chunk(a, chunk_size);
+    if (!fresh)
+      return NULL;
+    fresh->next = chunk;
+    a->head = fresh;
+    chunk = fresh;
+  }
+
+  offset = chunk->used;
+  chunk->used += size;
+
+  a->stats.allocs++;
+  a->stats.bytes += size;
+
+  return chunk->data + offset;
+}
+
+void *arena_calloc(Arena *a, size_t n, size_t size) {
+  void *p = arena_alloc(a, n * size);
+  if (p)
+    memset(p, 0, n * size);
+  return p;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t len) {
+  char *p = arena_alloc(a, len + 1);
+  if (p) {
+    memcpy(p, s, len);
+    p[len] = '\0';
+  }
+  return p;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+  return arena_strndup(a, s, strlen(s));
+}
+
+void arena_reset(Arena *a) {
+  ArenaChunk *chunk = a->head;
+  size_t total = 0;
+
+  a->stats.resets++;
+
+  if (!chunk)
+    return;
+
+  /* One chunk: just rewind it */
+  if (!chunk->next) {
+    chunk->used = 0;
+    return;
+  }
+
+  /*
+   * The line overflowed the first chunk. Replace the chain with a single
+   * chunk that would have held all of it, so the next line of this size
+   * fits without further allocation.
+   */
+  while (chunk) {
+    ArenaChunk *next = chunk->next;
+    total += chunk->size;
+    free(chunk);
+    chunk = next;
+  }
+  a->head = NULL;
+
+  if (total > ARENA_KEEP_MAX)
+    total = ARENA_KEEP_MAX;
+  a->head = new_chunk(a, total);
+}
+
+void arena_destroy(Arena *a) {
+  ArenaChunk *chunk = a->head;
+  while (chunk) {
+    ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  a->head = NULL;
+}
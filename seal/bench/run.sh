@@ -0,0 +1,233 @@
+#!/bin/bash
+# Seal benchmark suite
+#
+# usage: bench/run.sh [seal-binary]
+#
+# Prints one tab-separated line per benchmark:
+#   name  value  unit  direction  [baseline  change%  verdict]
+# direction is "higher" or "lower" (which way is better). Each value is
+# the median of BENCH_RUNS runs.
+#
+# Environment:
+#   BENCH_RUNS=5         runs per benchmark
+#   BENCH_SCALE=1        multiply the workload sizes
+#   BENCH_ONLY=regex     run only benchmarks whose name matches
+#   BASELINE=file        compare against a previous run's output
+#   BENCH_TOLERANCE=10   % change counted as a regression
+#
+# Exits 1 if any benchmark regressed by more than BENCH_TOLERANCE.
+
+set -euo pipefail
+
+SEAL=${1:-./seal}
+RUNS=${BENCH_RUNS:-5}
+SCALE=${BENCH_SCALE:-1}
+ONLY=${BENCH_ONLY:-.}
+TOLERANCE=${BENCH_TOLERANCE:-10}
+
+SEAL=$(cd "$(dirname "$SEAL")" && pwd)/$(basename "$SEAL")
+if [ ! -x "$SEAL" ]; then
+  echo "bench: $SEAL: not executable (run make first)" >&2
+  exit 2
+fi
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/seal-bench.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+
+RESULTS=$WORK/results.tsv
+: >"$RESULTS"
+
+now_ns() { date +%s%N; }
+
+# Median of the numbers on stdin
+median() {
+  sort -g | awk '{ v[NR] = $1 } END {
+    if (NR % 2) print v[(NR + 1) / 2]; else print (v[NR / 2] + v[NR / 2 + 1]) / 2
+  }'
+}
+
+# time_runs CMD...: print the wall time of each of RUNS runs, in seconds
+time_runs() {
+  local i start end
+  for ((i = 0; i < RUNS; i++)); do
+    start=$(now_ns)
+    "$@" >/dev/null
+    end=$(now_ns)
+    echo "$(((end - start) / 1000)) 1000000" | awk '{ printf "%.6f\n", $1 / $2 }'
+  done
+}
+
+# report NAME VALUE UNIT DIRECTION
+report() {
+  printf '%s\t%s\t%s\t%s\n' "$1" "$2" "$3" "$4" >>"$RESULTS"
+}
+
+selected() { [[ $1 =~ $ONLY ]]; }
+
+# --- lexer/parser throughput (seal -n parses without executing) ---------
+
+bench_parse() {
+  local lines=$((200000 * SCALE))
+  local corpus=$WORK/corpus.sh
+
+  awk -v n="$lines" 'BEGIN {
+    for (i = 0; i < n; i++) {
+      m = i % 5
+      if (m == 0) print "ls -la /usr/share/doc > /tmp/out." i " 2>&1"
+      else if (m == 1) print "grep -v \"^#\" file" i ".txt | sort | uniq -c | head -n 20"
+      else if (m == 2) print "echo \"hello $1\" '\''single quoted'\'' plain\\ escaped word"
+      else if (m == 3) print "cat < input" i " >> output" i " 2> errors &"
+      else print "printf \"%s\\n\" a b c d e f g h | tr a-z A-Z | wc -l"
+    }
+  }' >"$corpus"
+
+  local secs
+  secs=$(time_runs "$SEAL" -n "$corpus" | median)
+  report parse_lines "$(awk -v n="$lines" -v s="$secs" 'BEGIN { printf "%.0f", n / s }')" \
+    lines/s higher
+}
+
+# --- spawn rate: one external command per line --------------------------
+
+bench_spawn() {
+  local n=$((2000 * SCALE))
+  local script=$WORK/spawn.sh
+  local mode
+
+  for mode in spawn fork; do
+    {
+      [ "$mode" = fork ] && echo "set +o spawn"
+      for ((i = 0; i < n; i++)); do echo /bin/true; done
+    } >"$script"
+
+    local secs
+    secs=$(time_runs "$SEAL" "$script" | median)
+    report "spawn_rate_$mode" \
+      "$(awk -v n="$n" -v s="$secs" 'BEGIN { printf "%.0f", n / s }')" \
+      spawns/s higher
+  done
+}
+
+# --- N-stage pipeline latency -------------------------------------------
+
+bench_pipeline() {
+  local reps=$((200 * SCALE))
+  local stages script line i
+
+  for stages in 2 4 8; do
+    line="/bin/echo x"
+    for ((i = 1; i < stages; i++)); do line="$line | cat"; done
+    script=$WORK/pipe$stages.sh
+    for ((i = 0; i < reps; i++)); do echo "$line > /dev/null"; done >"$script"
+
+    local secs
+    secs=$(time_runs "$SEAL" "$script" | median)
+    report "pipeline_latency_$stages" \
+      "$(awk -v n="$reps" -v s="$secs" 'BEGIN { printf "%.1f", s / n * 1e6 }')" \
+      us lower
+  done
+}
+
+# --- pipe throughput through cat chains ---------------------------------
+
+bench_throughput() {
+  local mb=$((256 * SCALE))
+  local data=$WORK/data.bin
+  local stages script line i
+
+  head -c $((mb * 1024 * 1024)) /dev/zero >"$data"
+
+  for stages in 1 3; do
+    line="cat < $data"
+    for ((i = 1; i < stages; i++)); do line="$line | cat"; done
+    script=$WORK/thru$stages.sh
+    echo "$line > /dev/null" >"$script"
+
+    local secs
+    secs=$(time_runs "$SEAL" "$script" | median)
+    report "pipe_throughput_$stages" \
+      "$(awk -v mb="$mb" -v s="$secs" 'BEGIN { printf "%.0f", mb * 1048576 / s }')" \
+      bytes/s higher
+  done
+
+  script=$WORK/thru_tee.sh
+  echo "cat < $data | tee $WORK/tee.out | cat > /dev/null" >"$script"
+  local secs
+  secs=$(time_runs "$SEAL" "$script" | median)
+  report pipe_throughput_tee \
+    "$(awk -v mb="$mb" -v s="$secs" 'BEGIN { printf "%.0f", mb * 1048576 / s }')" \
+    bytes/s higher
+}
+
+# --- pipe capacity: external cat chain at default and 1 MiB pipes -------
+
+bench_pipesize() {
+  local mb=$((256 * SCALE))
+  local data=$WORK/data.bin
+  local size script
+
+  [ -f "$data" ] || head -c $((mb * 1024 * 1024)) /dev/zero >"$data"
+
+  for size in default 1m; do
+    script=$WORK/pipesize_$size.sh
+    {
+      [ "$size" != default ] && echo "set -o pipesize=$size"
+      echo "/bin/cat < $data | /bin/cat | /bin/cat > /dev/null"
+    } >"$script"
+
+    local secs
+    secs=$(time_runs "$SEAL" "$script" | median)
+    report "pipe_size_$size" \
+      "$(awk -v mb="$mb" -v s="$secs" 'BEGIN { printf "%.0f", mb * 1048576 / s }')" \
+      bytes/s higher
+  done
+}
+
+# --- spawn rate with a large environment --------------------------------
+
+bench_env() {
+  local n=$((2000 * SCALE))
+  local script=$WORK/env.sh
+  local vars=()
+  local i
+
+  for ((i = 0; i < 2000; i++)); do vars+=("BENCH_VAR_$i=value_$i"); done
+  for ((i = 0; i < n; i++)); do echo /bin/true; done >"$script"
+
+  local secs
+  secs=$(time_runs env "${vars[@]}" "$SEAL" "$script" | median)
+  report spawn_rate_bigenv \
+    "$(awk -v n="$n" -v s="$secs" 'BEGIN { printf "%.0f", n / s }')" \
+    spawns/s higher
+}
+
+for b in parse spawn pipeline throughput pipesize env; do
+  if selected "$b"; then
+    "bench_$b"
+  fi
+done
+
+# --- output and baseline comparison -------------------------------------
+
+if [ -z "${BASELINE:-}" ]; then
+  cat "$RESULTS"
+  exit 0
+fi
+
+if [ ! -r "$BASELINE" ]; then
+  echo "bench: $BASELINE: cannot read baseline" >&2
+  exit 2
+fi
+
+awk -F '\t' -v OFS='\t' -v tol="$TOLERANCE" '
+  NR == FNR { base[$1] = $2; next }
+  {
+    if (!($1 in base) || base[$1] == 0) { print $0, "-", "-", "new"; next }
+    change = ($2 - base[$1]) / base[$1] * 100
+    worse = ($4 == "higher") ? -change : change
+    verdict = (worse > tol) ? "REGRESSION" : (worse < -tol) ? "improved" : "ok"
+    if (verdict == "REGRESSION") failed = 1
+    printf "%s\t%s\t%s\t%s\t%s\t%+.1f%%\t%s\n", $1, $2, $3, $4, base[$1], change, verdict
+  }
+  END { exit failed }
+' "$BASELINE" "$RESULTS"
@@ -1,30 +1,78 @@
 #include "shell.h"
 
-int is_builtin(const char *cmd) {
-  return (strcmp(cmd, "cd") == 0 || strcmp(cmd, "exit") == 0 ||
-          strcmp(cmd, "jobs") == 0 || strcmp(cmd, "fg") == 0 ||
-          strcmp(cmd, "bg") == 0 || strcmp(cmd, "help") == 0 ||
-          strcmp(cmd, "export") == 0);
+/*
+ * Built-in command table. Stateful builtins change the shell itself, so
+ * inside a multi-command pipeline they run in a child like every other
+ * stage would (cd /tmp | cat must not move the shell). The accepts hook,
+ * when set, can decline an invocation so the external command runs.
+ */
+static Builtin builtins[] = {
+    {"cd", builtin_cd, NULL, BUILTIN_STATEFUL},
+    {"exit", builtin_exit, NULL, BUILTIN_STATEFUL},
+    {"jobs", builtin_jobs, NULL, 0},
+    {"fg", builtin_fg, NULL, BUILTIN_STATEFUL},
+    {"bg", builtin_bg, NULL, BUILTIN_STATEFUL},
+    {"wait", builtin_wait, NULL, BUILTIN_STATEFUL},
+    {"parallel", builtin_parallel, NULL, BUILTIN_BLOCKING},
+    {"help", builtin_help, NULL, 0},
+    {"history", builtin_history, NULL, 0},
+    {"export", builtin_export, NULL, BUILTIN_STATEFUL},
+    {"unset", builtin_unset, NULL, BUILTIN_STATEFUL},
+    {"hash", builtin_hash, NULL, BUILTIN_STATEFUL},
+    {"set", builtin_set, NULL, BUILTIN_STATEFUL},
+    {"memstats", builtin_memstats, NULL, 0},
+    {"enable", builtin_enable, NULL, BUILTIN_STATEFUL},
+    {"echo", builtin_echo, echo_accepts, 0},
+    {"printf", builtin_printf, printf_accepts, 0},
+    {"test", builtin_test, NULL, 0},
+    {"[", builtin_test, test_accepts, 0},
+    {"true", builtin_true, true_accepts, 0},
+    {":", builtin_true, NULL, 0},
+    {"false", builtin_false, true_accepts, 0},
+    {"pwd", builtin_pwd, pwd_accepts, 0},
+    {"cat", builtin_cat, cat_accepts, BUILTIN_BLOCKING},
+    {"tee", builtin_tee, tee_accepts, BUILTIN_BLOCKING},
+    {NULL, NULL, NULL, 0},
+};
+
+static Builtin *table_lookup(const char *cmd) {
+  for (Builtin *b = builtins; b->name; b++) {
+    if (strcmp(cmd, b->name) == 0) {
+      return b;
+    }
+  }
+  return NULL;
 }
 
-int execute_builtin(Command *cmd) {
-  if (strcmp(cmd->argv[0], "cd") == 0) {
-    return builtin_cd(cmd->argv);
-  } else if (strcmp(cmd->argv[0], "exit") == 0) {
-    return builtin_exit(cmd->argv);
-  } else if (strcmp(cmd->argv[0], "jobs") == 0) {
-    return builtin_jobs(cmd->argv);
-  } else if (strcmp(cmd->argv[0], "fg") == 0) {
-    return builtin_fg(cmd->argv);
-  } else if (strcmp(cmd->argv[0], "bg") == 0) {
-    return builtin_bg(cmd->argv);
-  } else if (strcmp(cmd->argv[0], "help") == 0) {
-    return builtin_help(cmd->argv);
-  } else if (strcmp(cmd->argv[0], "export") == 0) {
-    return builtin_export(cmd->argv);
+const Builtin *find_builtin(const char *cmd) {
+  Builtin *b = table_lookup(cmd);
+  if (b && (b->flags & BUILTIN_DISABLED)) {
+    return NULL;
   }
+  return b;
+}
 
-  return -1;
+const Builtin *lookup_builtin(char **argv) {
+  const Builtin *b = find_builtin(argv[0]);
+  if (b && b->accepts && !b->accepts(argv)) {
+    return NULL;
+  }
+  return b;
+}
+
+/* Name of the index'th builtin, or NULL past the end (for completion) */
+const char *builtin_name(int index) {
+  if (index < 0 || index >= (int)(sizeof(builtins) / sizeof(builtins[0])))
+    return NULL;
+  return builtins[index].name;
+}
+
+int execute_builtin(Command *cmd) {
+  const Builtin *b = lookup_builtin(cmd->argv);
+  if (!b) {
+    return -1;
+  }
+  return b->func(cmd->argv);
 }
 
 int builtin_cd(char **argv) {
@@ -32,7 +80,7 @@ int builtin_cd(char **argv) {
 
   if (argv[1] == NULL) {
     /* No argument, go to HOME */
-    dir = getenv("HOME");
+    dir = var_get("HOME");
     if (dir == NULL) {
       print_error("cd: HOME not set");
       return -1;
@@ -50,12 +98,20 @@ int builtin_cd(char **argv) {
 }
 
 int builtin_exit(char **argv) {
-  int status = 0;
+  int status = g_shell.last_status;
 
   if (argv[1] != NULL) {
     status = atoi(argv[1]);
   }
 
+  /* A subshell or forked stage has nothing of the shell's to clean up */
+  if (g_shell.in_subshell) {
+    fflush(stdout);
+    if (g_trace)
+      trace_flush();
+    _exit(status);
+  }
+
   cleanup_shell();
   exit(status);
 }
@@ -70,11 +126,12 @@ int builtin_fg(char **argv) {
 
   if (argv[1] == NULL) {
     /* Get most recent job */
-    job_id = g_shell.job_count;
-    if (job_id == 0) {
+    Job *job = find_last_job(0);
+    if (!job) {
       print_error("fg: no current job");
       return -1;
     }
+    job_id = job->job_id;
   } else {
     job_id = atoi(argv[1]);
   }
@@ -87,19 +144,12 @@ int builtin_bg(char **argv) {
 
   if (argv[1] == NULL) {
     /* Get most recent stopped job */
-    int i;
-    job_id = -1;
-    for (i = MAX_JOBS - 1; i >= 0; i--) {
-      if (g_shell.jobs[i].job_id != 0 && g_shell.jobs[i].state == JOB_STOPPED) {
-        job_id = g_shell.jobs[i].job_id;
-        break;
-      }
-    }
-
-    if (job_id == -1) {
+    Job *job = find_last_job(1);
+    if (!job) {
       print_error("bg: no stopped jobs");
       return -1;
     }
+    job_id = job->job_id;
   } else {
     job_id = atoi(argv[1]);
   }
@@ -107,6 +157,58 @@ int builtin_bg(char **argv) {
   return send_job_to_background(job_id, 1);
 }
 
+/*
+ * wait [-n] [%job|pid...]
+ * Block on the child event loop until the given jobs (or all background
+ * jobs) finish. Returns the exit status of the last job waited for.
+ */
+int builtin_wait(char **argv) {
+  int i = 1;
+  int status = 0;
+
+  if (argv[i] && strcmp(argv[i], "-n") == 0) {
+    return wait_any_job();
+  }
+
+  if (argv[i] == NULL) {
+    /* Wait for every running job */
+    int j;
+    for (j = 0; j < g_shell.job_cap; j++) {
+      Job *job = g_shell.jobs[j];
+      if (job && job->job_id != 0 && job->state == JOB_RUNNING) {
+        status = wait_job(job->job_id);
+        /* Ctrl-C stops the whole wait, not just this job's */
+        if (status == WAIT_INTERRUPTED && job->job_id != 0 &&
+            job->state == JOB_RUNNING)
+          return status;
+      }
+    }
+    return 0;
+  }
+
+  for (; argv[i]; i++) {
+    Job *job;
+    if (argv[i][0] == '%') {
+      job = get_job(atoi(argv[i] + 1));
+      status = wait_job(atoi(argv[i] + 1));
+    } else {
+      job = find_job_by_pgid((pid_t)atoi(argv[i]));
+      if (!job) {
+        fprintf(stderr, "seal: wait: pid %s is not a child of this shell\n",
+                argv[i]);
+        status = 127;
+        continue;
+      }
+      status = wait_job(job->job_id);
+    }
+    if (status == WAIT_INTERRUPTED && job && job->job_id != 0 &&
+        job->state == JOB_RUNNING)
+      break;
+  }
+
+  return status;
+}
+
 int builtin_help(char **argv) {
   printf("Seal Shell - Custom Shell with Job Control\n\n");
   printf("Built-in commands:\n");
@@ -115,15 +217,53 @@ int builtin_help(char **argv) {
   printf("  jobs           List active jobs\n");
   printf("  fg [job_id]    Bring job to foreground\n");
   printf("  bg [job_id]    Send job to background\n");
+  printf("  wait [-n] [%%job|pid]\n");
+  printf("                 Wait for background jobs to finish\n");
+  printf("  parallel [-j N] [-k] [-u] [cmd [args]] [::: arg...]\n");
+  printf("                 Run a task per input line, N at a time\n");
   printf("  help           Show this help\n");
-  printf("  export VAR=val Set environment variable\n\n");
+  printf("  history [N], history -f text\n");
+  printf("                 Show the last N lines, or lines containing text\n");
+  printf("  export VAR[=val]...\n");
+  printf("                 Set and export variables to commands\n");
+  printf("  unset VAR...   Remove variables\n");
+  printf("  hash [-r] [-p path name] [name...]\n");
+  printf("                 Show or edit the command path cache\n");
+  printf("  set [-o|+o opt] Set or show shell options\n");
+  printf("                 (spawn, jobserver[=N], pipesize[=N], globsort, edit)\n");
+  printf("  memstats       Show per-line allocation counters\n");
+  printf("  enable [-n] [name...]\n");
+  printf("                 Enable or disable builtins (-n runs the binary)\n");
+  printf("  echo, printf, test, [, true, :, false, pwd, cat, tee\n");
+  printf("                 Built-in versions of the common utilities\n\n");
   printf("Redirection operators:\n");
   printf("  <              Redirect input\n");
   printf("  >              Redirect output (truncate)\n");
   printf("  >>             Redirect output (append)\n");
   printf("  2>             Redirect stderr\n");
   printf("  2>&1           Redirect stderr to stdout\n");
-  printf("  |              Pipe\n\n");
+  printf("  <<WORD, <<-WORD\n");
+  printf("                 Here-document: lines up to WORD as input\n");
+  printf("  <<< word       Here-string: word and a newline as input\n");
+  printf("  |              Pipe\n");
+  printf("  ;, &&, ||      Run in sequence, if it succeeded, if it failed\n");
+  printf("  <(cmd), >(cmd) Process substitution (/dev/fd/N)\n");
+  printf("  ( list )       Run list in a subshell\n");
+  printf("  { list; }      Run list in the shell as one command\n\n");
+  printf("Variables:\n");
+  printf("  VAR=value      Set a shell variable (not exported)\n");
+  printf("  $VAR, ${VAR}   Value of VAR; $?, $#, $0-$9, $@, $* as usual\n");
+  printf("  ${VAR:-word}   word if VAR is unset or empty (also :=, :+)\n\n");
+  printf("Patterns:\n");
+  printf("  *, ?, [abc]    Matching paths, sorted unless set +o globsort\n");
+  printf("  a{b,c}d        abd acd\n\n");
+  printf("Timing:\n");
+  printf("  time [-p] cmd  Report per-stage CPU, memory and wall time\n");
+  printf("                 (TIMEFORMAT selects a one-line format)\n\n");
+  printf("Line editing:\n");
+  printf("  Up, Down       Previous and next history line\n");
+  printf("  Ctrl-R         Search the history as you type\n");
+  printf("  Tab            Complete a command or file name (twice: list)\n\n");
   printf("Job control:\n");
   printf("  &              Run command in background\n");
   printf("  Ctrl-C         Send SIGINT to foreground job\n");
@@ -132,27 +272,196 @@ int builtin_help(char **argv) {
   return 0;
 }
 
-int builtin_export(char **argv) {
-  if (argv[1] == NULL) {
-    print_error("export: missing argument");
+/* set -o jobserver[=N]: become a make jobserver with N slots */
+static int set_jobserver(int on, const char *arg) {
+  int slots;
+
+  if (!on) {
+    jobserver_stop();
+    g_shell.jobserver_slots = 0;
+    return 0;
+  }
+
+  slots = arg ? atoi(arg) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (slots < 1) {
+    fprintf(stderr, "seal: set: jobserver: %s: invalid slot count\n",
+            arg ? arg : "");
     return -1;
   }
+  if (jobserver_start(slots) < 0)
+    return -1;
+  g_shell.jobserver_slots = slots;
+  return 0;
+}
 
-  /* Parse VAR=value */
-  char *eq = strchr(argv[1], '=');
-  if (eq == NULL) {
-    print_error("export: invalid syntax (use VAR=value)");
+/* set -o pipesize[=N]: capacity of the pipes between stages */
+static int set_pipesize(int on, const char *arg) {
+  if (!on) {
+    g_shell.pipe_size = 0;
+    return 0;
+  }
+  if (set_pipe_size(arg) < 0) {
+    fprintf(stderr, "seal: set: pipesize: %s: invalid size\n", arg);
     return -1;
   }
+  return 0;
+}
 
-  *eq = '\0';
-  char *name = argv[1];
-  char *value = eq + 1;
+/* Shell options for set -o / set +o */
+typedef struct {
+  const char *name;
+  int *value;
+  int (*apply)(int on, const char *arg); /* Numeric option, NULL for a flag */
+} ShellOption;
 
-  if (setenv(name, value, 1) < 0) {
-    perror("setenv");
+static ShellOption shell_options[] = {
+    {"spawn", &g_shell.use_spawn, NULL},
+    {"jobserver", &g_shell.jobserver_slots, set_jobserver},
+    {"pipesize", &g_shell.pipe_size, set_pipesize},
+    {"globsort", &g_shell.glob_sort, NULL},
+    {"edit", &g_shell.line_edit, NULL},
+    {NULL, NULL, NULL},
+};
+
+int builtin_set(char **argv) {
+  ShellOption *opt;
+
+  /* List options */
+  if (argv[1] == NULL ||
+      (strcmp(argv[1], "-o") == 0 && argv[2] == NULL) ||
+      (strcmp(argv[1], "+o") == 0 && argv[2] == NULL)) {
+    for (opt = shell_options; opt->name; opt++) {
+      if (opt->apply && *opt->value)
+        printf("%-15s %d\n", opt->name, *opt->value);
+      else
+        printf("%-15s %s\n", opt->name, *opt->value ? "on" : "off");
+    }
+    return 0;
+  }
+
+  if ((strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0)) {
+    print_error("set: usage: set [-o|+o option[=value]]");
     return -1;
   }
 
+  /* name or name=value */
+  const char *eq = strchr(argv[2], '=');
+  size_t len = eq ? (size_t)(eq - argv[2]) : strlen(argv[2]);
+  int on = (argv[1][0] == '-');
+
+  for (opt = shell_options; opt->name; opt++) {
+    if (strlen(opt->name) != len || strncmp(opt->name, argv[2], len) != 0)
+      continue;
+    if (opt->apply)
+      return opt->apply(on, eq && on ? eq + 1 : NULL);
+    if (eq)
+      break;
+    *opt->value = on;
+    return 0;
+  }
+
+  fprintf(stderr, "seal: set: %s: invalid option name\n", argv[2]);
+  return -1;
+}
+
+int builtin_memstats(char **argv) {
+  ArenaStats *st = &g_shell.arena.stats;
+  /* Counters are read mid-line, so the current line is included */
+  double lines = (double)(st->resets + 1);
+
+  printf("lines:          %lu\n", st->resets + 1);
+  printf("arena allocs:   %lu (%.1f/line)\n", st->allocs, st->allocs / lines);
+  printf("arena bytes:    %lu (%.1f/line)\n", st->bytes, st->bytes / lines);
+  printf("chunk mallocs:  %lu (%.3f/line)\n", st->chunk_mallocs,
+         st->chunk_mallocs / lines);
+
+  if (argv[1] != NULL && strcmp(argv[1], "-r") == 0) {
+    memset(st, 0, sizeof(ArenaStats));
+  }
+
   return 0;
 }
+
+int builtin_enable(char **argv) {
+  int disable = 0;
+  int status = 0;
+  int i = 1;
+
+  if (argv[1] != NULL && strcmp(argv[1], "-n") == 0) {
+    disable = 1;
+    i = 2;
+  }
+
+  /* List enabled (or with -n, disabled) builtins */
+  if (argv[i] == NULL) {
+    for (Builtin *b = builtins; b->name; b++) {
+      if (((b->flags & BUILTIN_DISABLED) != 0) == disable) {
+        printf("enable %s%s\n", disable ? "-n " : "", b->name);
+      }
+    }
+    return 0;
+  }
+
+  for (; argv[i] != NULL; i++) {
+    Builtin *b = table_lookup(argv[i]);
+    if (!b) {
+      fprintf(stderr, "seal: enable: %s: not a shell builtin\n", argv[i]);
+      status = -1;
+    } else if (disable) {
+      b->flags |= BUILTIN_DISABLED;
+    } else {
+      b->flags &= ~BUILTIN_DISABLED;
+    }
+  }
+
+  return status;
+}
+
+int builtin_export(char **argv) {
+  int status = 0;
+
+  if (argv[1] == NULL) {
+    print_error("export: missing argument");
+    return -1;
+  }
+
+  /* export VAR=value sets and exports, export VAR exports */
+  for (int i = 1; argv[i]; i++) {
+    char *eq = strchr(argv[i], '=');
+    size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+
+    if (!is_var_name(argv[i], len)) {
+      fprintf(stderr, "seal: export: `%s': not a valid identifier\n",
+              argv[i]);
+      status = 1;
+      continue;
+    }
+
+    if (eq) {
+      *eq = '\0';
+      if (var_set(argv[i], eq + 1, 1) < 0)
+        status = 1;
+      *eq = '=';
+    } else {
+      var_export(argv[i]);
+    }
+  }
+
+  return status;
+}
+
+int builtin_unset(char **argv) {
+  int status = 0;
+
+  for (int i = 1; argv[i]; i++) {
+    if (!is_var_name(argv[i], strlen(argv[i]))) {
+      fprintf(stderr, "seal: unset: `%s': not a valid identifier\n",
+              argv[i]);
+      status = 1;
+      continue;
+    }
+    var_unset(argv[i]);
+  }
+
+  return status;
+}
@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/*
+ * Tab completion.
+ *
+ * Command names come from a trie of every executable on $PATH plus the
+ * builtins. It is built on the first Tab and then kept current instead
+ * of rescanned: each PATH directory has an inotify watch, and pending
+ * events are drained on the next Tab. A new executable is inserted on
+ * the spot; a removal, a mode change or a lost event marks the trie
+ * stale, and it is rebuilt once. Changing PATH rebuilds it too. Looking
+ * up a prefix walks one node per character, so Tab costs the same with
+ * ten or fifty thousand commands installed.
+ *
+ * Other words complete as file names, read from their directory when
+ * Tab is pressed.
+ */
+
+#define TRIE_INITIAL_NODES 4096
+#define INOTIFY_BUF_SIZE 4096
+#define WATCH_EVENTS                                                          \
+  (IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM |          \
+   IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* Trie node; children are a sibling chain sorted by character */
+typedef struct {
+  int child;     /* First child, -1 if none */
+  int sibling;   /* Next sibling, -1 if none */
+  char c;        /* Character on the edge into this node */
+  char terminal; /* A command name ends here */
+} TrieNode;
+
+/* A watched PATH directory */
+typedef struct {
+  int wd;     /* inotify watch descriptor */
+  char *path; /* Directory */
+} Watch;
+
+static TrieNode *nodes = NULL;
+static int node_count = 0;
+static int node_cap = 0;
+static char *trie_path = NULL; /* PATH the trie was built from */
+static int trie_stale = 1;     /* Rebuild before the next lookup */
+
+static int notify_fd = -1;
+static Watch *watches = NULL;
+static int watch_count = 0;
+
+static int new_node(char c) {
+  if (node_count == node_cap) {
+    int cap = node_cap ? node_cap * 2 : TRIE_INITIAL_NODES;
+    TrieNode *grown = realloc(nodes, cap * sizeof(TrieNode));
+    if (!grown) {
+      perror("realloc");
+      return -1;
+    }
+    nodes = grown;
+    node_cap = cap;
+  }
+  nodes[node_count] = (TrieNode){-1, -1, c, 0};
+  return node_count++;
+}
+
+static void trie_insert(const char *name) {
+  int node = 0;
+
+  for (const char *p = name; *p; p++) {
+    int *link = &nodes[node].child;
+    while (*link >= 0 && nodes[*link].c < *p)
+      link = &nodes[*link].sibling;
+
+    if (*link < 0 || nodes[*link].c != *p) {
+      int n = new_node(*p);
+      if (n < 0)
+        return;
+      /* nodes may have moved; find the link again */
+      link = &nodes[node].child;
+      while (*link >= 0 && nodes[*link].c < *p)
+        link = &nodes[*link].sibling;
+      nodes[n].sibling = *link;
+      *link = n;
+    }
+    node = *link;
+  }
+  nodes[node].terminal = 1;
+}
+
+/* Node reached by prefix, or -1 */
+static int trie_find(const char *prefix) {
+  int node = 0;
+
+  for (const char *p = prefix; *p && node >= 0; p++) {
+    node = nodes[node].child;
+    while (node >= 0 && nodes[node].c != *p)
+      node = nodes[node].sibling;
+  }
+  return node;
+}
+
+static int add_match(Completion *comp, const char *text, size_t len) {
+  if (comp->count == comp->cap) {
+    int cap = comp->cap ? comp->cap * 2 : 32;
+    char **grown = realloc(comp->matches, cap * sizeof(char *));
+    if (!grown) {
+      perror("realloc");
+      return -1;
+    }
+    comp->matches = grown;
+    comp->cap = cap;
+  }
+  comp->matches[comp->count] = strndup(text, len);
+  if (!comp->matches[comp->count])
+    return -1;
+  comp->count++;
+  return 0;
+}
+
+/* Every name below node, in order; name holds the first len bytes */
+static int trie_collect(int node, char *name, size_t len, Completion *comp) {
+  if (nodes[node].terminal && add_match(comp, name, len) < 0)
+    return -1;
+
+  for (int n = nodes[node].child; n >= 0; n = nodes[n].sibling) {
+    if (len + 1 >= PATH_MAX)
+      continue;
+    name[len] = nodes[n].c;
+    if (trie_collect(n, name, len + 1, comp) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static void drop_watches(void) {
+  if (notify_fd >= 0)
+    close(notify_fd);
+  notify_fd = -1;
+  for (int i = 0; i < watch_count; i++)
+    free(watches[i].path);
+  free(watches);
+  watches = NULL;
+  watch_count = 0;
+}
+
+static void scan_dir(const char *dir) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+
+  int dfd = dirfd(d);
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] == '.')
+      continue;
+    if (e->d_type != DT_REG && e->d_type != DT_LNK && e->d_type != DT_UNKNOWN)
+      continue;
+    if (faccessat(dfd, e->d_name, X_OK, AT_EACCESS) == 0)
+      trie_insert(e->d_name);
+  }
+  closedir(d);
+}
+
+/* Scan and watch every PATH directory, and add the builtins */
+static void build_trie(const char *path) {
+  node_count = 0;
+  if (new_node(0) < 0)
+    return;
+
+  drop_watches();
+  notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  char *copy = strdup(path);
+  int dir_count = 1;
+  for (const char *p = path; *p; p++)
+    dir_count += (*p == ':');
+  watches = calloc(dir_count, sizeof(Watch));
+
+  char *save = NULL;
+  for (char *dir = copy ? strtok_r(copy, ":", &save) : NULL; dir;
+       dir = strtok_r(NULL, ":", &save)) {
+    scan_dir(dir);
+    if (notify_fd < 0 || !watches)
+      continue;
+    int wd = inotify_add_watch(notify_fd, dir, WATCH_EVENTS);
+    if (wd >= 0) {
+      watches[watch_count].wd = wd;
+      watches[watch_count].path = strdup(dir);
+      watch_count++;
+    }
+  }
+  free(copy);
+
+  for (int i = 0; builtin_name(i); i++)
+    trie_insert(builtin_name(i));
+
+  free(trie_path);
+  trie_path = strdup(path);
+  trie_stale = 0;
+}
+
+static const char *watch_path(int wd) {
+  for (int i = 0; i < watch_count; i++) {
+    if (watches[i].wd == wd)
+      return watches[i].path;
+  }
+  return NULL;
+}
+
+/* Apply the inotify events that arrived since the last Tab */
+static void drain_events(void) {
+  char buf[INOTIFY_BUF_SIZE]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  char file[PATH_MAX];
+
+  while (notify_fd >= 0) {
+    ssize_t n = read(notify_fd, buf, sizeof(buf));
+    if (n <= 0)
+      return;
+
+    for (char *p = buf; p < buf + n;) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+
+      const char *dir = watch_path(ev->wd);
+      if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB) && ev->len &&
+          dir && ev->name[0] != '.') {
+        snprintf(file, sizeof(file), "%s/%s", dir, ev->name);
+        if (access(file, X_OK) == 0) {
+          trie_insert(ev->name);
+          continue;
+        }
+        /* A new file that is not executable yet changes nothing */
+        if (!(ev->mask & IN_ATTRIB))
+          continue;
+      }
+      /* Removals may leave a name that another directory still has */
+      trie_stale = 1;
+    }
+  }
+}
+
+/* Commands starting with prefix */
+static int complete_command(const char *prefix, Completion *comp) {
+  const char *path = var_get("PATH");
+  char name[PATH_MAX];
+
+  if (!path)
+    path = "";
+  if (!trie_path || strcmp(trie_path, path) != 0)
+    trie_stale = 1;
+  drain_events();
+  if (trie_stale)
+    build_trie(path);
+  if (node_count == 0)
+    return 0;
+
+  int node = trie_find(prefix);
+  if (node < 0)
+    return 0;
+
+  size_t len = strlen(prefix);
+  if (len >= sizeof(name))
+    return 0;
+  memcpy(name, prefix, len);
+  return trie_collect(node, name, len, comp);
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Files starting with word; directories get a trailing slash */
+static int complete_file(const char *word, Completion *comp) {
+  const char *slash = strrchr(word, '/');
+  const char *base = slash ? slash + 1 : word;
+  size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+  size_t base_len = strlen(base);
+  char dir[PATH_MAX];
+  char match[PATH_MAX];
+  struct stat st;
+
+  if (dir_len >= sizeof(dir))
+    return 0;
+  memcpy(dir, word, dir_len);
+  dir[dir_len] = '\0';
+
+  DIR *d = opendir(dir_len ? dir : ".");
+  if (!d)
+    return 0;
+
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    const char *name = e->d_name;
+    if (strncmp(name, base, base_len) != 0)
+      continue;
+    /* Dot files only when asked for, and never . or .. */
+    if (name[0] == '.' && (base_len == 0 || name[1] == '\0' ||
+                           (name[1] == '.' && name[2] == '\0')))
+      continue;
+
+    int is_dir = e->d_type == DT_DIR;
+    if (e->d_type == DT_LNK || e->d_type == DT_UNKNOWN)
+      is_dir = fstatat(dirfd(d), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+
+    int len = snprintf(match, sizeof(match), "%s%s%s", dir, name,
+                       is_dir ? "/" : "");
+    if (len >= (int)sizeof(match))
+      continue;
+    if (add_match(comp, match, len) < 0) {
+      closedir(d);
+      return -1;
+    }
+  }
+  closedir(d);
+
+  if (comp->count > 1)
+    qsort(comp->matches, comp->count, sizeof(char *), compare_names);
+  return 0;
+}
+
+/*
+ * Completions for the word of line that ends at cursor. The word is
+ * unquoted first; matches are whole words, not yet quoted, and
+ * comp->start is where the word begins in line.
+ */
+int complete_line(const char *line, size_t cursor, Completion *comp) {
+  char word[PATH_MAX];
+  size_t len = 0;
+  size_t start = 0;
+  char quote = 0;
+
+  memset(comp, 0, sizeof(*comp));
+
+  /* The word starts after the last unquoted blank or operator */
+  for (size_t i = 0; i < cursor; i++) {
+    char c = line[i];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+    } else if (c == '\\') {
+      i++;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (strchr(" \t|&;<>()", c)) {
+      start = i + 1;
+    }
+  }
+  comp->start = start;
+
+  /* Unquote it */
+  quote = 0;
+  for (size_t i = start; i < cursor && len + 1 < sizeof(word); i++) {
+    char c = line[i];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+      else
+        word[len++] = c;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == '\\' && i + 1 < cursor) {
+      word[len++] = line[++i];
+    } else {
+      word[len++] = c;
+    }
+  }
+  word[len] = '\0';
+
+  /* First word of a command: after nothing but blanks and operators */
+  size_t before = start;
+  while (before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t'))
+    before--;
+  int command = before == 0 || strchr("|&;({", line[before - 1]);
+
+  if (command && !strchr(word, '/'))
+    return complete_command(word, comp);
+  return complete_file(word, comp);
+}
+
+void complete_free(Completion *comp) {
+  for (int i = 0; i < comp->count; i++)
+    free(comp->matches[i]);
+  free(comp->matches);
+  memset(comp, 0, sizeof(*comp));
+}
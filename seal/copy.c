@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+/*
+ * cat and tee.
+ *
+ * Both move data between the descriptors the pipeline set up without
+ * bringing it into user space when the kernel allows it: sendfile()
+ * from a regular file, splice() when either side is a pipe, and for tee
+ * tee() to duplicate the input pipe onto stdout before splicing it to
+ * the file. Anything else (a terminal, an O_APPEND file splice refuses,
+ * several tee files) falls back to read()/write() through a buffer.
+ */
+
+#define COPY_CHUNK (1 << 20)
+#define COPY_BUF_SIZE (128 * 1024)
+
+static int is_pipe(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static int is_regular(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/*
+ * Zero-copy transfer until EOF. Returns 0 when done, -1 on error, or 1
+ * if neither sendfile() nor splice() works for this pair of descriptors
+ * (nothing has been transferred then).
+ */
+static int copy_kernel(int in, int out) {
+  int use_sendfile = is_regular(in);
+  int moved = 0;
+
+  if (!use_sendfile && !is_pipe(in) && !is_pipe(out))
+    return 1;
+
+  while (1) {
+    ssize_t n;
+    if (use_sendfile)
+      n = sendfile(out, in, NULL, COPY_CHUNK);
+    else
+      n = splice(in, NULL, out, NULL, COPY_CHUNK,
+                 SPLICE_F_MOVE | SPLICE_F_MORE);
+
+    if (n > 0) {
+      moved = 1;
+      continue;
+    }
+    if (n == 0)
+      return 0;
+    if (errno == EINTR)
+      continue;
+    if (!moved && (errno == EINVAL || errno == ENOSYS)) {
+      /* sendfile() can't, but splice() may still if one end is a pipe */
+      if (use_sendfile && (is_pipe(in) || is_pipe(out))) {
+        use_sendfile = 0;
+        continue;
+      }
+      return 1;
+    }
+    return -1;
+  }
+}
+
+static int copy_buffered(int in, int out) {
+  static char buf[COPY_BUF_SIZE];
+
+  while (1) {
+    ssize_t n = read(in, buf, sizeof(buf));
+    if (n == 0)
+      return 0;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (write_all(out, buf, n) < 0)
+      return -1;
+  }
+}
+
+/* Copy in to out until EOF */
+static int copy_fd(int in, int out) {
+  int r = copy_kernel(in, out);
+  if (r == 1)
+    r = copy_buffered(in, out);
+  return r;
+}
+
+/* ---- cat ---- */
+
+int builtin_cat(char **argv) {
+  int status = 0;
+  int i = 1;
+
+  fflush(stdout);
+
+  if (argv[i] && strcmp(argv[i], "-u") == 0)
+    i++;
+
+  /* No files: copy stdin */
+  if (!argv[i]) {
+    if (copy_fd(STDIN_FILENO, STDOUT_FILENO) < 0) {
+      if (errno != EPIPE)
+        fprintf(stderr, "seal: cat: %s\n", strerror(errno));
+      return 1;
+    }
+    return 0;
+  }
+
+  for (; argv[i]; i++) {
+    int fd = STDIN_FILENO;
+
+    if (strcmp(argv[i], "-") != 0) {
+      fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        fprintf(stderr, "seal: cat: %s: %s\n", argv[i], strerror(errno));
+        status = 1;
+        continue;
+      }
+    }
+
+    int r = copy_fd(fd, STDOUT_FILENO);
+    int err = errno;
+    if (fd != STDIN_FILENO)
+      close(fd);
+
+    if (r < 0) {
+      /* The reader went away: stop quietly, like a cat killed by SIGPIPE */
+      if (err == EPIPE)
+        return 1;
+      fprintf(stderr, "seal: cat: %s: %s\n", argv[i], strerror(err));
+      status = 1;
+    }
+  }
+
+  return status;
+}
+
+/* Options other than -u belong to the real cat */
+int cat_accepts(char **argv) {
+  for (int i = 1; argv[i]; i++) {
+    if (argv[i][0] == '-' && argv[i][1] &&
+        !(i == 1 && strcmp(argv[i], "-u") == 0))
+      return 0;
+  }
+  return 1;
+}
+
+/* ---- tee ---- */
+
+/* Move len bytes from the in pipe to fd, splicing where possible */
+static int splice_exact(int in, int fd, size_t len) {
+  static char buf[COPY_BUF_SIZE];
+  int can_splice = 1;
+
+  while (len > 0) {
+    ssize_t n;
+    if (can_splice) {
+      n = splice(in, NULL, fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        can_splice = 0;
+        continue;
+      }
+    } else {
+      n = read(in, buf, len < sizeof(buf) ? len : sizeof(buf));
+      if (n > 0 && write_all(fd, buf, n) < 0)
+        return -1;
+    }
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Pipe to pipe with one file: tee() copies the input onto stdout by
+ * reference, then the same bytes are spliced from the input to the file.
+ * Returns 1 if tee() is not available for these descriptors.
+ */
+static int tee_kernel(int file) {
+  int moved = 0;
+
+  while (1) {
+    ssize_t n = tee(STDIN_FILENO, STDOUT_FILENO, COPY_CHUNK, 0);
+    if (n == 0)
+      return 0;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (!moved && (errno == EINVAL || errno == ENOSYS))
+        return 1;
+      return -1;
+    }
+    moved = 1;
+
+    if (splice_exact(STDIN_FILENO, file, n) < 0)
+      return -1;
+  }
+}
+
+static int tee_buffered(int *files, int count, char **names, int *status) {
+  static char buf[COPY_BUF_SIZE];
+
+  while (1) {
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n == 0)
+      return 0;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    if (write_all(STDOUT_FILENO, buf, n) < 0)
+      return -1;
+
+    for (int i = 0; i < count; i++) {
+      if (files[i] >= 0 && write_all(files[i], buf, n) < 0) {
+        fprintf(stderr, "seal: tee: %s: %s\n", names[i], strerror(errno));
+        close(files[i]);
+        files[i] = -1;
+        *status = 1;
+      }
+    }
+  }
+}
+
+int builtin_tee(char **argv) {
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  int status = 0;
+  int count = 0;
+  int i = 1;
+
+  fflush(stdout);
+
+  if (argv[i] && strcmp(argv[i], "-a") == 0) {
+    flags = (flags & ~O_TRUNC) | O_APPEND;
+    i++;
+  }
+
+  char **names = &argv[i];
+  while (names[count])
+    count++;
+
+  int *files = malloc((count + 1) * sizeof(int));
+  if (!files) {
+    perror("malloc");
+    return 1;
+  }
+
+  int open_count = 0;
+  int last = -1;
+  for (int k = 0; k < count; k++) {
+    files[k] = open(names[k], flags, 0666);
+    if (files[k] < 0) {
+      fprintf(stderr, "seal: tee: %s: %s\n", names[k], strerror(errno));
+      status = 1;
+    } else {
+      open_count++;
+      last = files[k];
+    }
+  }
+
+  int r = 1;
+  if (open_count <= 1 && is_pipe(STDIN_FILENO) && is_pipe(STDOUT_FILENO)) {
+    if (open_count == 0)
+      r = copy_kernel(STDIN_FILENO, STDOUT_FILENO);
+    else
+      r = tee_kernel(last);
+  }
+  if (r == 1)
+    r = tee_buffered(files, count, names, &status);
+  if (r < 0 && errno != EPIPE)
+    fprintf(stderr, "seal: tee: %s\n", strerror(errno));
+
+  for (int k = 0; k < count; k++) {
+    if (files[k] >= 0)
+      close(files[k]);
+  }
+  free(files);
+
+  return r < 0 ? 1 : status;
+}
+
+/* Options other than -a belong to the real tee */
+int tee_accepts(char **argv) {
+  for (int i = 1; argv[i]; i++) {
+    if (argv[i][0] == '-' && argv[i][1] &&
+        !(i == 1 && strcmp(argv[i], "-a") == 0))
+      return 0;
+  }
+  return 1;
+}
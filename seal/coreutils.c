@@ -0,0 +1,743 @@
+#include "shell.h"
+#include <ctype.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/*
+ * In-shell versions of the small utilities scripts run most often: echo,
+ * printf, test/[, true, false and pwd. They follow the coreutils
+ * behaviour for the usual flags. Invocations they don't cover (--help,
+ * --version, unknown printf conversions) are declined through the
+ * table's accepts hook and run the external binary instead, as does
+ * anything disabled with "enable -n name".
+ */
+
+/* --help/--version belong to the real binary */
+static int is_gnu_info_option(const char *arg) {
+  return arg && (strcmp(arg, "--help") == 0 || strcmp(arg, "--version") == 0);
+}
+
+int builtin_true(char **argv) {
+  (void)argv;
+  return 0;
+}
+
+int builtin_false(char **argv) {
+  (void)argv;
+  return 1;
+}
+
+/* true --help and false --help print the binaries' usage, as echo does */
+int true_accepts(char **argv) {
+  return !(is_gnu_info_option(argv[1]) && argv[2] == NULL);
+}
+
+/* ---- escapes shared by echo -e and printf ---- */
+
+/*
+ * Decode one backslash escape at s (just past the backslash) into *out.
+ * octal_prefix selects echo/%b syntax (\0NNN) over printf syntax (\NNN).
+ * Returns the number of bytes consumed, 0 for \c (stop output) or -1 if
+ * the sequence is not an escape.
+ */
+static int decode_escape(const char *s, char *out, int octal_prefix) {
+  int i, value;
+
+  switch (*s) {
+  case '\\':
+    *out = '\\';
+    return 1;
+  case 'a':
+    *out = '\a';
+    return 1;
+  case 'b':
+    *out = '\b';
+    return 1;
+  case 'c':
+    return 0;
+  case 'e':
+    *out = 033;
+    return 1;
+  case 'f':
+    *out = '\f';
+    return 1;
+  case 'n':
+    *out = '\n';
+    return 1;
+  case 'r':
+    *out = '\r';
+    return 1;
+  case 't':
+    *out = '\t';
+    return 1;
+  case 'v':
+    *out = '\v';
+    return 1;
+  case 'x':
+    if (!isxdigit((unsigned char)s[1]))
+      return -1;
+    value = 0;
+    for (i = 1; i <= 2 && isxdigit((unsigned char)s[i]); i++) {
+      value = value * 16 +
+              (isdigit((unsigned char)s[i]) ? s[i] - '0'
+                                             : tolower((unsigned char)s[i]) -
+                                                   'a' + 10);
+    }
+    *out = (char)value;
+    return i;
+  default:
+    break;
+  }
+
+  if (octal_prefix ? (*s == '0') : (*s >= '0' && *s <= '7')) {
+    int start = octal_prefix ? 1 : 0;
+    value = 0;
+    for (i = start; i < start + 3 && s[i] >= '0' && s[i] <= '7'; i++) {
+      value = value * 8 + (s[i] - '0');
+    }
+    *out = (char)value;
+    return i;
+  }
+
+  return -1;
+}
+
+/* Print s with escapes expanded. Returns 0 if \c was seen. */
+static int print_escaped(const char *s, int octal_prefix) {
+  while (*s) {
+    if (*s == '\\' && s[1]) {
+      char c;
+      int n = decode_escape(s + 1, &c, octal_prefix);
+      if (n == 0)
+        return 0;
+      if (n > 0) {
+        putchar(c);
+        s += n + 1;
+        continue;
+      }
+    }
+    putchar(*s++);
+  }
+  return 1;
+}
+
+/* ---- echo ---- */
+
+int builtin_echo(char **argv) {
+  int newline = 1;
+  int escapes = 0;
+  int i = 1;
+
+  /* Options are only recognised if every letter is one of n, e, E */
+  for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+    const char *p = argv[i] + 1;
+    if (strspn(p, "neE") != strlen(p))
+      break;
+    for (; *p; p++) {
+      if (*p == 'n')
+        newline = 0;
+      else if (*p == 'e')
+        escapes = 1;
+      else
+        escapes = 0;
+    }
+  }
+
+  for (int first = 1; argv[i]; i++, first = 0) {
+    if (!first)
+      putchar(' ');
+    if (escapes) {
+      if (!print_escaped(argv[i], 1))
+        return 0;
+    } else {
+      fputs(argv[i], stdout);
+    }
+  }
+
+  if (newline)
+    putchar('\n');
+
+  return 0;
+}
+
+int echo_accepts(char **argv) {
+  return !(is_gnu_info_option(argv[1]) && argv[2] == NULL);
+}
+
+/* ---- printf ---- */
+
+#define PRINTF_CONVERSIONS "diouxXfFeEgGaAcsb%"
+
+int printf_accepts(char **argv) {
+  const char *p;
+
+  if (argv[1] == NULL || is_gnu_info_option(argv[1]))
+    return 0;
+
+  /* Leave conversions we don't implement (e.g. %q) to the real printf */
+  for (p = argv[1]; (p = strchr(p, '%')) != NULL;) {
+    p++;
+    p += strspn(p, "-+ #0'");
+    p += strspn(p, "0123456789*");
+    if (*p == '.') {
+      p++;
+      p += strspn(p, "0123456789*");
+    }
+    if (*p == '\0' || strchr(PRINTF_CONVERSIONS, *p) == NULL)
+      return 0;
+    p++;
+  }
+
+  return 1;
+}
+
+/* Numeric argument, with 'c / "c giving the character code */
+static int printf_number(const char *arg, long long *sval,
+                         unsigned long long *uval, int is_unsigned) {
+  char *end;
+
+  errno = 0;
+  if (arg[0] == '\'' || arg[0] == '"') {
+    *sval = (unsigned char)arg[1];
+    *uval = (unsigned char)arg[1];
+    return 0;
+  }
+
+  if (is_unsigned && arg[0] != '-') {
+    *uval = strtoull(arg, &end, 0);
+    *sval = (long long)*uval;
+  } else {
+    *sval = strtoll(arg, &end, 0);
+    *uval = (unsigned long long)*sval;
+  }
+
+  if (end == arg || *end != '\0' || errno == ERANGE) {
+    fprintf(stderr, "seal: printf: %s: %s\n", arg,
+            errno == ERANGE ? "Numerical result out of range"
+                            : "expected a numeric value");
+    return -1;
+  }
+  return 0;
+}
+
+static int printf_double(const char *arg, long double *val) {
+  char *end;
+
+  if (arg[0] == '\'' || arg[0] == '"') {
+    *val = (unsigned char)arg[1];
+    return 0;
+  }
+
+  errno = 0;
+  *val = strtold(arg, &end);
+  if (end == arg || *end != '\0') {
+    fprintf(stderr, "seal: printf: %s: expected a numeric value\n", arg);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * One pass over the format. Returns the number of arguments consumed, or
+ * -1 if \c stopped output. *status is set to 1 on conversion errors.
+ */
+static int printf_pass(const char *fmt, char **args, int *status) {
+  int used = 0;
+  const char *p = fmt;
+
+  while (*p) {
+    if (*p == '\\') {
+      char c;
+      int n = p[1] ? decode_escape(p + 1, &c, 0) : -1;
+      if (n == 0)
+        return -1;
+      if (n > 0) {
+        putchar(c);
+        p += n + 1;
+      } else {
+        putchar(*p++);
+      }
+      continue;
+    }
+
+    if (*p != '%') {
+      putchar(*p++);
+      continue;
+    }
+
+    if (p[1] == '%') {
+      putchar('%');
+      p += 2;
+      continue;
+    }
+
+    /* Build "%[flags][width][.prec]" with * resolved from the arguments */
+    const char *start = p;
+    char spec[64];
+    size_t n = 0;
+    spec[n++] = '%';
+    p++;
+
+    while (*p && strchr("-+ #0'", *p) && n < 16)
+      spec[n++] = *p++;
+
+    for (int part = 0; part < 2; part++) {
+      if (part == 1) {
+        if (*p != '.')
+          break;
+        spec[n++] = *p++;
+      }
+      if (*p == '*') {
+        long long v = 0;
+        unsigned long long u;
+        if (args[used] && printf_number(args[used], &v, &u, 0) < 0)
+          *status = 1;
+        if (args[used])
+          used++;
+        n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)v);
+        p++;
+      } else {
+        while (isdigit((unsigned char)*p) && n < 40)
+          spec[n++] = *p++;
+      }
+    }
+
+    char conv = *p++;
+    if (conv == '%') {
+      /* Only a bare %% is a literal percent sign */
+      fflush(stdout);
+      fprintf(stderr, "seal: printf: %.*s: invalid conversion specification\n",
+              (int)(p - start), start);
+      *status = 1;
+      return -1;
+    }
+
+    const char *arg = args[used] ? args[used] : NULL;
+    if (arg)
+      used++;
+
+    switch (conv) {
+    case 'd':
+    case 'i': {
+      long long v = 0;
+      unsigned long long u;
+      if (arg && printf_number(arg, &v, &u, 0) < 0)
+        *status = 1;
+      memcpy(spec + n, "lld", 4);
+      printf(spec, v);
+      break;
+    }
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X': {
+      long long v;
+      unsigned long long u = 0;
+      if (arg && printf_number(arg, &v, &u, 1) < 0)
+        *status = 1;
+      spec[n++] = 'l';
+      spec[n++] = 'l';
+      spec[n++] = conv;
+      spec[n] = '\0';
+      printf(spec, u);
+      break;
+    }
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A': {
+      long double v = 0;
+      if (arg && printf_double(arg, &v) < 0)
+        *status = 1;
+      spec[n++] = 'L';
+      spec[n++] = conv;
+      spec[n] = '\0';
+      printf(spec, v);
+      break;
+    }
+    case 'c':
+      spec[n++] = 'c';
+      spec[n] = '\0';
+      printf(spec, arg ? arg[0] : '\0');
+      break;
+    case 's':
+      spec[n++] = 's';
+      spec[n] = '\0';
+      printf(spec, arg ? arg : "");
+      break;
+    case 'b':
+      if (arg && !print_escaped(arg, 1))
+        return -1;
+      break;
+    default:
+      /* Rejected by printf_accepts() */
+      break;
+    }
+  }
+
+  return used;
+}
+
+int builtin_printf(char **argv) {
+  int status = 0;
+  char **args = argv + 2;
+
+  /* The format is reused while arguments remain */
+  do {
+    int used = printf_pass(argv[1], args, &status);
+    if (used <= 0)
+      break;
+    args += used;
+  } while (*args);
+
+  return status;
+}
+
+/* ---- test / [ ---- */
+
+typedef struct {
+  char **argv; /* Arguments (without the command name and ]) */
+  int argc;
+  int pos;
+  int error;
+} TestState;
+
+static void test_error(TestState *t, const char *msg, const char *arg) {
+  if (!t->error) {
+    if (arg)
+      fprintf(stderr, "seal: test: %s: %s\n", arg, msg);
+    else
+      fprintf(stderr, "seal: test: %s\n", msg);
+  }
+  t->error = 1;
+}
+
+static int test_integer(TestState *t, const char *s, long long *out) {
+  char *end;
+  while (isspace((unsigned char)*s))
+    s++;
+  errno = 0;
+  *out = strtoll(s, &end, 10);
+  while (isspace((unsigned char)*end))
+    end++;
+  if (end == s || *end != '\0' || errno == ERANGE) {
+    test_error(t, "integer expression expected", s);
+    return -1;
+  }
+  return 0;
+}
+
+static int is_unary_op(const char *s) {
+  return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghknprstuwxzGLOS", s[1]);
+}
+
+static int is_binary_op(const char *s) {
+  static const char *ops[] = {"=",   "==",  "!=",  "-eq", "-ne", "-lt", "-le",
+                              "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+  for (int i = 0; ops[i]; i++) {
+    if (strcmp(s, ops[i]) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+static int test_unary(TestState *t, char op, const char *arg) {
+  struct stat st;
+
+  switch (op) {
+  case 'n':
+    return arg[0] != '\0';
+  case 'z':
+    return arg[0] == '\0';
+  case 't': {
+    long long fd;
+    if (test_integer(t, arg, &fd) < 0)
+      return 0;
+    return fd >= 0 && fd <= INT_MAX && isatty((int)fd);
+  }
+  case 'r':
+    return access(arg, R_OK) == 0;
+  case 'w':
+    return access(arg, W_OK) == 0;
+  case 'x':
+    return access(arg, X_OK) == 0;
+  case 'h':
+  case 'L':
+    return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+  default:
+    break;
+  }
+
+  if (stat(arg, &st) < 0)
+    return 0;
+
+  switch (op) {
+  case 'e':
+    return 1;
+  case 'f':
+    return S_ISREG(st.st_mode);
+  case 'd':
+    return S_ISDIR(st.st_mode);
+  case 'b':
+    return S_ISBLK(st.st_mode);
+  case 'c':
+    return S_ISCHR(st.st_mode);
+  case 'p':
+    return S_ISFIFO(st.st_mode);
+  case 'S':
+    return S_ISSOCK(st.st_mode);
+  case 's':
+    return st.st_size > 0;
+  case 'g':
+    return (st.st_mode & S_ISGID) != 0;
+  case 'u':
+    return (st.st_mode & S_ISUID) != 0;
+  case 'k':
+    return (st.st_mode & S_ISVTX) != 0;
+  case 'O':
+    return st.st_uid == geteuid();
+  case 'G':
+    return st.st_gid == getegid();
+  default:
+    return 0;
+  }
+}
+
+static int mtime_cmp(const struct stat *a, const struct stat *b) {
+  if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+    return a->st_mtim.tv_sec < b->st_mtim.tv_sec ? -1 : 1;
+  if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec)
+    return a->st_mtim.tv_nsec < b->st_mtim.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+static int test_binary(TestState *t, const char *left, const char *op,
+                       const char *right) {
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+    return strcmp(left, right) == 0;
+  if (strcmp(op, "!=") == 0)
+    return strcmp(left, right) != 0;
+
+  if (op[1] == 'n' && op[2] == 't') {
+    struct stat a, b;
+    int la = stat(left, &a), lb = stat(right, &b);
+    return la == 0 && (lb < 0 || mtime_cmp(&a, &b) > 0);
+  }
+  if (op[1] == 'o' && op[2] == 't') {
+    struct stat a, b;
+    int la = stat(left, &a), lb = stat(right, &b);
+    return lb == 0 && (la < 0 || mtime_cmp(&a, &b) < 0);
+  }
+  if (op[1] == 'e' && op[2] == 'f') {
+    struct stat a, b;
+    return stat(left, &a) == 0 && stat(right, &b) == 0 &&
+           a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+  }
+
+  long long l, r;
+  if (test_integer(t, left, &l) < 0 || test_integer(t, right, &r) < 0)
+    return 0;
+
+  if (strcmp(op, "-eq") == 0)
+    return l == r;
+  if (strcmp(op, "-ne") == 0)
+    return l != r;
+  if (strcmp(op, "-lt") == 0)
+    return l < r;
+  if (strcmp(op, "-le") == 0)
+    return l <= r;
+  if (strcmp(op, "-gt") == 0)
+    return l > r;
+  return l >= r;
+}
+
+static int test_or(TestState *t);
+
+/* primary: ( expr ) | ! primary | unary arg | arg op arg | arg */
+static int test_primary(TestState *t) {
+  int remaining = t->argc - t->pos;
+  char **a = t->argv + t->pos;
+
+  if (remaining <= 0) {
+    test_error(t, "argument expected", NULL);
+    return 0;
+  }
+
+  /* Binary operators take precedence over a leading ! or ( */
+  if (remaining >= 3 && is_binary_op(a[1])) {
+    t->pos += 3;
+    return test_binary(t, a[0], a[1], a[2]);
+  }
+
+  if (strcmp(a[0], "!") == 0) {
+    t->pos++;
+    return !test_primary(t);
+  }
+
+  if (strcmp(a[0], "(") == 0) {
+    t->pos++;
+    int result = test_or(t);
+    if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0) {
+      test_error(t, "missing ')'", NULL);
+      return 0;
+    }
+    t->pos++;
+    return result;
+  }
+
+  if (remaining >= 2 && is_unary_op(a[0])) {
+    t->pos += 2;
+    return test_unary(t, a[0][1], a[1]);
+  }
+
+  t->pos++;
+  return a[0][0] != '\0';
+}
+
+static int test_and(TestState *t) {
+  int result = test_primary(t);
+  while (t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+    t->pos++;
+    int rhs = test_primary(t);
+    result = result && rhs;
+  }
+  return result;
+}
+
+static int test_or(TestState *t) {
+  int result = test_and(t);
+  while (t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+    t->pos++;
+    int rhs = test_and(t);
+    result = result || rhs;
+  }
+  return result;
+}
+
+/* POSIX rules for up to four arguments, the grammar above otherwise */
+static int test_eval(TestState *t) {
+  char **a = t->argv;
+
+  switch (t->argc) {
+  case 0:
+    return 0;
+  case 1:
+    t->pos = 1;
+    return a[0][0] != '\0';
+  case 2:
+    if (strcmp(a[0], "!") == 0) {
+      t->pos = 2;
+      return a[1][0] == '\0';
+    }
+    if (is_unary_op(a[0])) {
+      t->pos = 2;
+      return test_unary(t, a[0][1], a[1]);
+    }
+    test_error(t, "unary operator expected", a[0]);
+    return 0;
+  case 3:
+    if (is_binary_op(a[1])) {
+      t->pos = 3;
+      return test_binary(t, a[0], a[1], a[2]);
+    }
+    if (strcmp(a[0], "!") == 0) {
+      TestState sub = {a + 1, 2, 0, 0};
+      int r = !test_eval(&sub);
+      t->error = sub.error;
+      t->pos = 3;
+      return r;
+    }
+    if (strcmp(a[0], "(") == 0 && strcmp(a[2], ")") == 0) {
+      t->pos = 3;
+      return a[1][0] != '\0';
+    }
+    break;
+  case 4:
+    if (strcmp(a[0], "!") == 0) {
+      TestState sub = {a + 1, 3, 0, 0};
+      int r = !test_eval(&sub);
+      t->error = sub.error;
+      t->pos = 4;
+      return r;
+    }
+    break;
+  default:
+    break;
+  }
+
+  return test_or(t);
+}
+
+int builtin_test(char **argv) {
+  TestState t = {argv + 1, 0, 0, 0};
+
+  while (t.argv[t.argc])
+    t.argc++;
+
+  /* [ needs a closing ] */
+  if (strcmp(argv[0], "[") == 0) {
+    if (t.argc == 0 || strcmp(t.argv[t.argc - 1], "]") != 0) {
+      print_error("[: missing ']'");
+      return 2;
+    }
+    t.argc--;
+  }
+
+  int result = test_eval(&t);
+  if (!t.error && t.pos < t.argc) {
+    test_error(&t, "extra argument", t.argv[t.pos]);
+  }
+
+  if (t.error)
+    return 2;
+  return result ? 0 : 1;
+}
+
+int test_accepts(char **argv) {
+  /* [ --help and [ --version are informational in coreutils */
+  return !(strcmp(argv[0], "[") == 0 && is_gnu_info_option(argv[1]) &&
+           argv[2] == NULL);
+}
+
+/* ---- pwd ---- */
+
+int builtin_pwd(char **argv) {
+  int logical = 0;
+  char buf[PATH_MAX];
+
+  for (int i = 1; argv[i]; i++) {
+    if (strcmp(argv[i], "-L") == 0) {
+      logical = 1;
+    } else if (strcmp(argv[i], "-P") == 0) {
+      logical = 0;
+    } else {
+      fprintf(stderr, "seal: pwd: %s: invalid option\n", argv[i]);
+      return 1;
+    }
+  }
+
+  /* -L prints $PWD if it really names the current directory */
+  if (logical) {
+    const char *pwd = var_get("PWD");
+    struct stat a, b;
+    if (pwd && pwd[0] == '/' && stat(pwd, &a) == 0 && stat(".", &b) == 0 &&
+        a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+      printf("%s\n", pwd);
+      return 0;
+    }
+  }
+
+  if (getcwd(buf, sizeof(buf)) == NULL) {
+    perror("pwd");
+    return 1;
+  }
+
+  printf("%s\n", buf);
+  return 0;
+}
+
+int pwd_accepts(char **argv) { return !is_gnu_info_option(argv[1]); }
@@ -0,0 +1,570 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <limits.h>
+#include <sys/ioctl.h>
+
+/*
+ * Line editor.
+ *
+ * Interactive lines are read with the terminal in raw mode, derived from
+ * the shell_tmodes saved at startup, which are put back before the line
+ * runs. Every change redraws the line with a single write(): carriage
+ * return, prompt, text, clear to end of line and a cursor move back.
+ *
+ * Keys follow readline's emacs mode: Ctrl-A/E/B/F and the arrows move,
+ * Backspace, Delete, Ctrl-D/K/U/W delete, Ctrl-L clears the screen and
+ * Ctrl-C drops the line. Up/Down and Ctrl-P/N walk the history, Ctrl-R
+ * searches it as you type and Tab completes (complete.c); a second Tab
+ * lists the candidates. Multibyte characters move as one; lines wider
+ * than the terminal are not wrapped specially.
+ */
+
+#define EDIT_INITIAL_SIZE 256
+#define SEARCH_MAX 256
+#define COMPLETE_ASK_LIMIT 100
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+
+/* Keys decoded from escape sequences */
+enum {
+  KEY_UP = 256,
+  KEY_DOWN,
+  KEY_LEFT,
+  KEY_RIGHT,
+  KEY_HOME,
+  KEY_END,
+  KEY_DELETE,
+};
+
+typedef struct {
+  char *buf;          /* Line being edited */
+  size_t len;         /* Bytes in buf */
+  size_t cap;         /* Allocated size */
+  size_t pos;         /* Cursor offset in buf */
+  const char *prompt; /* Shown before the line */
+  int hist;           /* History entry shown (history_count(): a new line) */
+  char *draft;        /* The new line, kept while browsing the history */
+  int tabs;           /* Tab presses in a row */
+} Editor;
+
+static Editor ed;
+
+static int reserve(size_t need) {
+  if (need <= ed.cap)
+    return 0;
+
+  size_t cap = ed.cap ? ed.cap : EDIT_INITIAL_SIZE;
+  while (cap < need)
+    cap *= 2;
+  char *grown = realloc(ed.buf, cap);
+  if (!grown) {
+    perror("realloc");
+    return -1;
+  }
+  ed.buf = grown;
+  ed.cap = cap;
+  return 0;
+}
+
+static void output(const char *s, size_t n) { write_all(STDOUT_FILENO, s, n); }
+
+static void bell(void) { output("\a", 1); }
+
+/* Screen columns of n bytes: UTF-8 continuation bytes take none */
+static size_t columns(const char *s, size_t n) {
+  size_t cols = 0;
+  for (size_t i = 0; i < n; i++)
+    cols += ((unsigned char)s[i] & 0xc0) != 0x80;
+  return cols;
+}
+
+static int is_continuation(size_t i) {
+  return i < ed.len && ((unsigned char)ed.buf[i] & 0xc0) == 0x80;
+}
+
+static void refresh(void) {
+  size_t prompt_len = strlen(ed.prompt);
+  char *out = malloc(prompt_len + ed.len + 32);
+  if (!out)
+    return;
+
+  size_t n = 0;
+  out[n++] = '\r';
+  memcpy(out + n, ed.prompt, prompt_len);
+  n += prompt_len;
+  memcpy(out + n, ed.buf, ed.len);
+  n += ed.len;
+  n += sprintf(out + n, "\x1b[K");
+  size_t back = columns(ed.buf + ed.pos, ed.len - ed.pos);
+  if (back > 0)
+    n += sprintf(out + n, "\x1b[%zuD", back);
+
+  output(out, n);
+  free(out);
+}
+
+static void insert(const char *s, size_t n) {
+  if (reserve(ed.len + n + 1) < 0)
+    return;
+  memmove(ed.buf + ed.pos + n, ed.buf + ed.pos, ed.len - ed.pos);
+  memcpy(ed.buf + ed.pos, s, n);
+  ed.len += n;
+  ed.pos += n;
+  ed.buf[ed.len] = '\0';
+}
+
+/* Remove [from, to) */
+static void erase(size_t from, size_t to) {
+  memmove(ed.buf + from, ed.buf + to, ed.len - to);
+  ed.len -= to - from;
+  ed.buf[ed.len] = '\0';
+  if (ed.pos > to)
+    ed.pos -= to - from;
+  else if (ed.pos > from)
+    ed.pos = from;
+}
+
+static void set_line(const char *s, size_t n) {
+  ed.len = 0;
+  ed.pos = 0;
+  if (reserve(n + 1) == 0)
+    insert(s, n);
+}
+
+/* Start of the character before i, and the one after it */
+static size_t char_before(size_t i) {
+  if (i > 0)
+    i--;
+  while (i > 0 && is_continuation(i))
+    i--;
+  return i;
+}
+
+static size_t char_after(size_t i) {
+  if (i < ed.len)
+    i++;
+  while (is_continuation(i))
+    i++;
+  return i;
+}
+
+/* A byte, or one of the KEY_ codes; -1 at end of input */
+static int read_key(void) {
+  unsigned char c;
+  ssize_t n;
+
+  while ((n = read(STDIN_FILENO, &c, 1)) < 0 && errno == EINTR)
+    ;
+  if (n <= 0)
+    return -1;
+  if (c != 0x1b)
+    return c;
+
+  /* ESC [ X, ESC O X or ESC [ N ~ */
+  unsigned char seq[2];
+  if (read(STDIN_FILENO, &seq[0], 1) != 1 ||
+      (seq[0] != '[' && seq[0] != 'O'))
+    return 0;
+  if (read(STDIN_FILENO, &seq[1], 1) != 1)
+    return 0;
+
+  if (seq[1] >= '0' && seq[1] <= '9') {
+    unsigned char end;
+    if (read(STDIN_FILENO, &end, 1) != 1 || end != '~')
+      return 0;
+    switch (seq[1]) {
+    case '1':
+    case '7':
+      return KEY_HOME;
+    case '3':
+      return KEY_DELETE;
+    case '4':
+    case '8':
+      return KEY_END;
+    default:
+      return 0;
+    }
+  }
+
+  switch (seq[1]) {
+  case 'A':
+    return KEY_UP;
+  case 'B':
+    return KEY_DOWN;
+  case 'C':
+    return KEY_RIGHT;
+  case 'D':
+    return KEY_LEFT;
+  case 'H':
+    return KEY_HOME;
+  case 'F':
+    return KEY_END;
+  default:
+    return 0;
+  }
+}
+
+/* Show the history entry step away from the current one */
+static void history_move(int step) {
+  int count = history_count();
+  int target = ed.hist + step;
+  size_t len;
+
+  if (target < 0 || target > count) {
+    bell();
+    return;
+  }
+
+  if (ed.hist == count) {
+    free(ed.draft);
+    ed.draft = strndup(ed.buf, ed.len);
+  }
+  ed.hist = target;
+
+  if (target == count) {
+    set_line(ed.draft ? ed.draft : "", ed.draft ? strlen(ed.draft) : 0);
+  } else {
+    const char *text = history_entry(target, &len);
+    set_line(text, len);
+  }
+}
+
+/*
+ * Ctrl-R: search the history as the query is typed; Ctrl-R again finds
+ * the next older match. Ctrl-G puts the line back. Any other key keeps
+ * the match and is returned to be handled as usual.
+ */
+static int reverse_search(void) {
+  char query[SEARCH_MAX];
+  size_t query_len = 0;
+  int count = history_count();
+  int match = -1;
+  int failed = 0;
+  size_t len = 0;
+  const char *text = "";
+
+  query[0] = '\0';
+  while (1) {
+    char head[SEARCH_MAX + 48];
+    int n = snprintf(head, sizeof(head), "\r(%sreverse-i-search)`%s': ",
+                     failed ? "failed " : "", query);
+    output(head, n);
+    output(text, len);
+    output("\x1b[K", 3);
+
+    int key = read_key();
+    int found = -1;
+
+    if (key == CTRL_KEY('R')) {
+      /* Skip older copies of the line already shown */
+      size_t found_len;
+      found = history_search(query, match >= 0 ? match : count);
+      while (found >= 0 && match >= 0) {
+        const char *older = history_entry(found, &found_len);
+        if (found_len != len || memcmp(older, text, len) != 0)
+          break;
+        found = history_search(query, found);
+      }
+    } else if (key == 127 || key == CTRL_KEY('H')) {
+      if (query_len > 0)
+        query[--query_len] = '\0';
+      found = history_search(query, count);
+    } else if (key >= 32 && key < 256 && query_len + 1 < sizeof(query)) {
+      query[query_len++] = key;
+      query[query_len] = '\0';
+      /* The current match may still match the longer query */
+      found = history_search(query, match >= 0 ? match + 1 : count);
+    } else {
+      if (key == CTRL_KEY('G')) {
+        refresh();
+        return 0;
+      }
+      if (match >= 0) {
+        set_line(text, len);
+        ed.hist = match;
+      }
+      refresh();
+      return key;
+    }
+
+    failed = found < 0 && query_len > 0;
+    if (found >= 0) {
+      match = found;
+      text = history_entry(match, &len);
+    }
+  }
+}
+
+/* Append word to out with the shell's special characters escaped */
+static size_t quote_word(char *out, const char *word, size_t len) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (strchr(" \t\n\\'\"|&;()<>$`*?[]{}!#~", word[i]))
+      out[n++] = '\\';
+    out[n++] = word[i];
+  }
+  return n;
+}
+
+static void list_matches(Completion *comp) {
+  struct winsize ws;
+  size_t width = 80;
+  size_t widest = 0;
+
+  if (comp->count > COMPLETE_ASK_LIMIT) {
+    char ask[64];
+    int n = snprintf(ask, sizeof(ask),
+                     "\nDisplay all %d possibilities? (y or n)", comp->count);
+    output(ask, n);
+    int key = read_key();
+    if (key != 'y' && key != 'Y') {
+      output("\n", 1);
+      refresh();
+      return;
+    }
+  }
+
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+    width = ws.ws_col;
+
+  /* Files are listed by their last component */
+  const char **names = malloc(comp->count * sizeof(char *));
+  if (!names)
+    return;
+  for (int i = 0; i < comp->count; i++) {
+    const char *m = comp->matches[i];
+    size_t len = strlen(m);
+    const char *slash = len > 1 ? memrchr(m, '/', len - 1) : NULL;
+    names[i] = slash ? slash + 1 : m;
+    if (strlen(names[i]) > widest)
+      widest = strlen(names[i]);
+  }
+
+  size_t cols = width / (widest + 2);
+  if (cols == 0)
+    cols = 1;
+  size_t rows = (comp->count + cols - 1) / cols;
+
+  output("\n", 1);
+  for (size_t r = 0; r < rows; r++) {
+    for (size_t c = 0; c < cols; c++) {
+      size_t i = c * rows + r;
+      if (i >= (size_t)comp->count)
+        break;
+      char cell[PATH_MAX + 2];
+      int n = snprintf(cell, sizeof(cell), "%-*s", (int)(widest + 2),
+                       names[i]);
+      output(cell, n < (int)sizeof(cell) ? n : (int)sizeof(cell) - 1);
+    }
+    output("\n", 1);
+  }
+  free(names);
+  refresh();
+}
+
+/* Tab: complete the word before the cursor as far as it is unambiguous */
+static void complete(void) {
+  Completion comp;
+
+  if (complete_line(ed.buf, ed.pos, &comp) < 0 || comp.count == 0) {
+    complete_free(&comp);
+    bell();
+    return;
+  }
+
+  /* Longest common prefix of the matches */
+  const char *first = comp.matches[0];
+  size_t common = strlen(first);
+  for (int i = 1; i < comp.count; i++) {
+    size_t j = 0;
+    while (j < common && comp.matches[i][j] == first[j])
+      j++;
+    common = j;
+  }
+
+  char *text = malloc(2 * common + 2);
+  if (!text) {
+    complete_free(&comp);
+    return;
+  }
+  size_t n = quote_word(text, first, common);
+  /* A unique match is finished, except a directory */
+  if (comp.count == 1 && first[common - 1] != '/')
+    text[n++] = ' ';
+
+  size_t word_len = ed.pos - comp.start;
+  if (n != word_len || memcmp(text, ed.buf + comp.start, n) != 0) {
+    erase(comp.start, ed.pos);
+    insert(text, n);
+    refresh();
+  } else if (ed.tabs > 1) {
+    list_matches(&comp);
+  } else {
+    bell();
+  }
+
+  free(text);
+  complete_free(&comp);
+}
+
+/* Read a line without the editor when the terminal cannot go raw */
+static const char *plain_line(size_t *len) {
+  static char *line = NULL;
+  static size_t cap = 0;
+
+  output(ed.prompt, strlen(ed.prompt));
+  ssize_t n = getline(&line, &cap, stdin);
+  if (n < 0)
+    return NULL;
+  if (n > 0 && line[n - 1] == '\n')
+    n--;
+  *len = n;
+  return line;
+}
+
+/*
+ * Read one line from the terminal with editing. Returns the text (valid
+ * until the next call, without a newline) or NULL at end of input.
+ */
+const char *edit_line(const char *prompt, size_t *len) {
+  struct termios raw = g_shell.shell_tmodes;
+
+  ed.prompt = prompt;
+  fflush(stdout);
+
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if (tcsetattr(g_shell.shell_terminal, TCSADRAIN, &raw) < 0)
+    return plain_line(len);
+
+  ed.len = 0;
+  ed.pos = 0;
+  ed.hist = history_count();
+  ed.tabs = 0;
+  free(ed.draft);
+  ed.draft = NULL;
+  if (reserve(EDIT_INITIAL_SIZE) < 0)
+    return NULL;
+  ed.buf[0] = '\0';
+  refresh();
+
+  int key = read_key();
+  while (key >= 0) {
+    int next = -2;
+
+    ed.tabs = key == '\t' ? ed.tabs + 1 : 0;
+
+    switch (key) {
+    case '\r':
+    case '\n':
+      ed.pos = ed.len;
+      refresh();
+      output("\n", 1);
+      tcsetattr(g_shell.shell_terminal, TCSADRAIN, &g_shell.shell_tmodes);
+      *len = ed.len;
+      return ed.buf;
+
+    case CTRL_KEY('D'):
+      if (ed.len == 0) {
+        key = -1;
+        continue;
+      }
+      /* Fall through */
+    case KEY_DELETE:
+      if (ed.pos < ed.len)
+        erase(ed.pos, char_after(ed.pos));
+      break;
+
+    case 127:
+    case CTRL_KEY('H'):
+      if (ed.pos > 0)
+        erase(char_before(ed.pos), ed.pos);
+      break;
+
+    case CTRL_KEY('C'):
+      /* Drop the line and start over */
+      output("^C\n", 3);
+      ed.len = 0;
+      ed.pos = 0;
+      ed.buf[0] = '\0';
+      ed.hist = history_count();
+      g_shell.last_status = 130;
+      break;
+
+    case CTRL_KEY('A'):
+    case KEY_HOME:
+      ed.pos = 0;
+      break;
+    case CTRL_KEY('E'):
+    case KEY_END:
+      ed.pos = ed.len;
+      break;
+    case CTRL_KEY('B'):
+    case KEY_LEFT:
+      ed.pos = char_before(ed.pos);
+      break;
+    case CTRL_KEY('F'):
+    case KEY_RIGHT:
+      ed.pos = char_after(ed.pos);
+      break;
+
+    case CTRL_KEY('K'):
+      erase(ed.pos, ed.len);
+      break;
+    case CTRL_KEY('U'):
+      erase(0, ed.pos);
+      break;
+    case CTRL_KEY('W'): {
+      size_t start = ed.pos;
+      while (start > 0 && ed.buf[start - 1] == ' ')
+        start--;
+      while (start > 0 && ed.buf[start - 1] != ' ')
+        start--;
+      erase(start, ed.pos);
+      break;
+    }
+
+    case CTRL_KEY('L'):
+      output("\x1b[H\x1b[2J", 7);
+      break;
+
+    case CTRL_KEY('P'):
+    case KEY_UP:
+      history_move(-1);
+      break;
+    case CTRL_KEY('N'):
+    case KEY_DOWN:
+      history_move(1);
+      break;
+
+    case CTRL_KEY('R'):
+      next = reverse_search();
+      break;
+
+    case '\t':
+      complete();
+      break;
+
+    default:
+      if (key >= 32 && key < 256) {
+        char c = key;
+        insert(&c, 1);
+      }
+      break;
+    }
+
+    if (next > 0) {
+      key = next;
+      continue;
+    }
+    if (key != '\t' && key != CTRL_KEY('R'))
+      refresh();
+    key = read_key();
+  }
+
+  /* End of input, or Ctrl-D on an empty line */
+  tcsetattr(g_shell.shell_terminal, TCSADRAIN, &g_shell.shell_tmodes);
+  return NULL;
+}
@@ -0,0 +1,724 @@
+#include "shell.h"
+#include <ctype.h>
+
+/*
+ * Word expansion.
+ *
+ * The lexer removes quotes from words without parameters right away. A
+ * word with a $ keeps its raw text and is expanded here just before its
+ * pipeline runs, so "a=1; echo $a" and "false; echo $?" see what the
+ * commands before them did. Expansion handles $NAME, ${NAME} and
+ * ${NAME:-word} (also -, :=, =, :+ and +), $0-$9, ${N}, $#, $? and
+ * $@/$*, removing quotes and backslashes as it goes. Results are not
+ * split into fields, except that each parameter of $@ is its own word.
+ * Here-document bodies whose delimiter was not quoted get parameter
+ * expansion too, with their quotes left alone.
+ *
+ * Brace expansion runs earlier, on the raw tokens between tokenize() and
+ * parse_list(). Pathname expansion runs last: while a word is built, a
+ * pattern copy is kept with every quoted or expanded byte escaped, and
+ * if an unquoted *, ? or [...] made it in, the word is replaced by the
+ * paths it matches (glob.c), or kept as it is when nothing matches.
+ */
+
+/* Text of the word being built */
+typedef struct {
+  char *buf;      /* malloc'd, grown as needed */
+  size_t len;     /* Bytes written */
+  size_t cap;     /* Allocated size */
+  char *pat;      /* The word as a pattern (malloc'd) */
+  size_t pat_len; /* Bytes written to pat */
+  size_t pat_cap; /* Allocated size of pat */
+  int magic;      /* An unquoted *, ? or [ was written */
+} WordBuf;
+
+/* Words produced by expansion (arena) */
+typedef struct {
+  char **words; /* Words in order */
+  int count;    /* Number of words */
+  int cap;      /* Allocated slots */
+} WordList;
+
+static int reserve(char **buf, size_t *cap, size_t need) {
+  if (need <= *cap)
+    return 0;
+
+  size_t new_cap = *cap ? *cap * 2 : 64;
+  while (new_cap < need)
+    new_cap *= 2;
+  char *grown = realloc(*buf, new_cap);
+  if (!grown) {
+    perror("realloc");
+    return -1;
+  }
+  *buf = grown;
+  *cap = new_cap;
+  return 0;
+}
+
+/* Append literal text: quoted, escaped or the value of a parameter */
+static int buf_put(WordBuf *b, const char *s, size_t n) {
+  if (reserve(&b->buf, &b->cap, b->len + n + 1) < 0 ||
+      reserve(&b->pat, &b->pat_cap, b->pat_len + 2 * n + 1) < 0)
+    return -1;
+
+  memcpy(b->buf + b->len, s, n);
+  b->len += n;
+  b->buf[b->len] = '\0';
+
+  for (size_t i = 0; i < n; i++) {
+    if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == ']' ||
+        s[i] == '\\')
+      b->pat[b->pat_len++] = '\\';
+    b->pat[b->pat_len++] = s[i];
+  }
+  b->pat[b->pat_len] = '\0';
+  return 0;
+}
+
+/* Append an unquoted byte, which keeps its meaning in the pattern */
+static int buf_put_unquoted(WordBuf *b, char c) {
+  if (c != '*' && c != '?' && c != '[' && c != ']')
+    return buf_put(b, &c, 1);
+
+  if (reserve(&b->buf, &b->cap, b->len + 2) < 0 ||
+      reserve(&b->pat, &b->pat_cap, b->pat_len + 2) < 0)
+    return -1;
+  b->buf[b->len++] = c;
+  b->buf[b->len] = '\0';
+  b->pat[b->pat_len++] = c;
+  b->pat[b->pat_len] = '\0';
+  if (c != ']')
+    b->magic = 1;
+  return 0;
+}
+
+static int list_push(WordList *wl, char *word, Arena *arena) {
+  if (wl->count == wl->cap) {
+    int cap = wl->cap ? wl->cap * 2 : 8;
+    char **grown = arena_alloc(arena, cap * sizeof(char *));
+    if (!grown)
+      return -1;
+    if (wl->count > 0)
+      memcpy(grown, wl->words, wl->count * sizeof(char *));
+    wl->words = grown;
+    wl->cap = cap;
+  }
+  wl->words[wl->count++] = word;
+  return 0;
+}
+
+/* Finish the current word, or the paths it matches, and start a new one */
+static int emit_word(WordBuf *b, WordList *wl, Arena *arena) {
+  int matches = 0;
+
+  if (b->magic && is_glob_pattern(b->pat)) {
+    char **paths;
+    matches = glob_expand(b->pat, &paths, arena);
+    if (matches < 0)
+      return -1;
+    for (int i = 0; i < matches; i++) {
+      if (list_push(wl, paths[i], arena) < 0)
+        return -1;
+    }
+  }
+
+  if (matches == 0) {
+    char *text = arena_strndup(arena, b->buf ? b->buf : "", b->len);
+    if (!text || list_push(wl, text, arena) < 0)
+      return -1;
+  }
+
+  b->len = 0;
+  b->pat_len = 0;
+  b->magic = 0;
+  return 0;
+}
+
+/* The '}' closing the ${ at p, skipping quoted text and nested ${ } */
+static const char *find_brace_end(const char *p, const char *end) {
+  int depth = 0;
+  char quote = 0;
+
+  for (const char *q = p; q < end; q++) {
+    if (quote) {
+      if (*q == quote)
+        quote = 0;
+      else if (*q == '\\' && quote == '"' && q + 1 < end)
+        q++;
+    } else if (*q == '\\' && q + 1 < end) {
+      q++;
+    } else if (*q == '"' || *q == '\'') {
+      quote = *q;
+    } else if (*q == '{') {
+      depth++;
+    } else if (*q == '}' && --depth == 0) {
+      return q;
+    }
+  }
+  return NULL;
+}
+
+/* Value of $0-$N, or NULL past the last positional parameter */
+static const char *positional(long index) {
+  if (index == 0)
+    return g_shell.arg0;
+  if (index > 0 && index <= g_shell.pos_count)
+    return g_shell.pos_args[index - 1];
+  return NULL;
+}
+
+static int expand_text(const char *p, const char *end, char quote,
+                       WordBuf *b, WordList *wl, Arena *arena, int *quoted);
+
+/*
+ * ${...} between p (just past the '{') and the closing brace. The name
+ * is a variable, a positional number, ? or #, optionally followed by an
+ * operator and a word that is expanded only when it is used.
+ */
+static int expand_braced(const char *p, const char *close, char quote,
+                         WordBuf *b, WordList *wl, Arena *arena) {
+  const char *name = p;
+  const char *value = NULL;
+  char num[16];
+  int is_var = 0;
+
+  if (isdigit((unsigned char)*p)) {
+    char *num_end;
+    long index = strtol(p, &num_end, 10);
+    value = positional(index);
+    p = num_end;
+  } else if (*p == '?' || *p == '#') {
+    snprintf(num, sizeof(num), "%d",
+             *p == '?' ? g_shell.last_status : g_shell.pos_count);
+    value = num;
+    p++;
+  } else {
+    while (p < close && (isalnum((unsigned char)*p) || *p == '_'))
+      p++;
+    if (!is_var_name(name, p - name)) {
+      print_error("bad substitution");
+      return -1;
+    }
+    value = var_lookup(name, p - name);
+    is_var = 1;
+  }
+  size_t name_len = p - name;
+
+  if (p == close) {
+    return value ? buf_put(b, value, strlen(value)) : 0;
+  }
+
+  /* With a colon, an empty value counts as unset */
+  int colon = (*p == ':');
+  if (colon)
+    p++;
+  char op = *p++;
+  if (p > close || (op != '-' && op != '=' && op != '+')) {
+    print_error("bad substitution");
+    return -1;
+  }
+  int set = value && (!colon || *value);
+
+  switch (op) {
+  case '-':
+    if (set)
+      return buf_put(b, value, strlen(value));
+    return expand_text(p, close, quote, b, wl, arena, NULL);
+
+  case '=':
+    if (set)
+      return buf_put(b, value, strlen(value));
+    if (!is_var) {
+      print_error("bad substitution: cannot assign to this parameter");
+      return -1;
+    } else {
+      size_t start = b->len;
+      if (expand_text(p, close, quote, b, wl, arena, NULL) < 0)
+        return -1;
+      char *var = strndup(name, name_len);
+      char *assigned = strndup(b->buf ? b->buf + start : "", b->len - start);
+      int r = (var && assigned) ? var_set(var, assigned, 0) : -1;
+      free(var);
+      free(assigned);
+      return r;
+    }
+
+  default:
+    /* + substitutes the word only when the parameter is set */
+    if (set)
+      return expand_text(p, close, quote, b, wl, arena, NULL);
+    return 0;
+  }
+}
+
+/*
+ * Expand the parameter at *pp (just past the '$'). Returns 1 when done,
+ * 0 when *pp does not start a parameter (the $ is literal), -1 on error.
+ */
+static int expand_parameter(const char **pp, const char *end, char quote,
+                            WordBuf *b, WordList *wl, Arena *arena) {
+  const char *p = *pp;
+  const char *value = NULL;
+  char num[16];
+
+  if (p >= end)
+    return 0;
+
+  if (*p == '{') {
+    const char *close = find_brace_end(p, end);
+    if (!close) {
+      print_error("bad substitution: missing }");
+      return -1;
+    }
+    if (expand_braced(p + 1, close, quote, b, wl, arena) < 0)
+      return -1;
+    *pp = close + 1;
+    return 1;
+  } else if (isdigit((unsigned char)*p)) {
+    value = positional(*p - '0');
+    p++;
+  } else if (*p == '#' || *p == '?') {
+    snprintf(num, sizeof(num), "%d",
+             *p == '?' ? g_shell.last_status : g_shell.pos_count);
+    value = num;
+    p++;
+  } else if (*p == '@' || *p == '*') {
+    for (int i = 0; i < g_shell.pos_count; i++) {
+      if (i > 0) {
+        /* Outside a word (a here-document body) $@ joins like $* */
+        if (*p == '@' && wl) {
+          if (emit_word(b, wl, arena) < 0)
+            return -1;
+        } else if (buf_put(b, " ", 1) < 0) {
+          return -1;
+        }
+      }
+      if (buf_put(b, g_shell.pos_args[i], strlen(g_shell.pos_args[i])) < 0)
+        return -1;
+    }
+    p++;
+  } else if (isalpha((unsigned char)*p) || *p == '_') {
+    const char *name = p;
+    while (p < end && (isalnum((unsigned char)*p) || *p == '_'))
+      p++;
+    value = var_lookup(name, p - name);
+  } else {
+    return 0;
+  }
+
+  if (value && buf_put(b, value, strlen(value)) < 0)
+    return -1;
+
+  *pp = p;
+  return 1;
+}
+
+/*
+ * Remove quotes, process backslashes and expand parameters in
+ * [p, end), starting inside quote (0 or '"'). Sets *quoted if any
+ * quotes were seen.
+ */
+static int expand_text(const char *p, const char *end, char quote,
+                       WordBuf *b, WordList *wl, Arena *arena, int *quoted) {
+  while (p < end) {
+    char c = *p;
+    int r = 0;
+
+    if (quote == '\'') {
+      /* Everything is literal inside single quotes */
+      if (c == '\'')
+        quote = 0;
+      else
+        r = buf_put(b, p, 1);
+      p++;
+    } else if (c == '\\' && p + 1 < end) {
+      /* Inside double quotes only a few characters can be escaped */
+      if (quote == '"' && !strchr("$`\"\\\n", p[1]))
+        r = buf_put(b, p, 2);
+      else
+        r = buf_put(b, p + 1, 1);
+      p += 2;
+    } else if (c == '$') {
+      p++;
+      int found = expand_parameter(&p, end, quote, b, wl, arena);
+      if (found < 0)
+        return -1;
+      if (found == 0)
+        r = buf_put(b, "$", 1);
+    } else if (quote == '"') {
+      if (c == '"')
+        quote = 0;
+      else
+        r = buf_put(b, p, 1);
+      p++;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+      if (quoted)
+        *quoted = 1;
+      p++;
+    } else {
+      r = buf_put_unquoted(b, c);
+      p++;
+    }
+
+    if (r < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Expand one raw word into wl. An unquoted word that expands to nothing
+ * (an unset $NAME, "$@" with no parameters) produces no word at all.
+ */
+static int expand_word(const char *raw, WordList *wl, Arena *arena) {
+  WordBuf b = {NULL, 0, 0, NULL, 0, 0, 0};
+  int quoted = 0;
+  int words_before = wl->count;
+  int r = expand_text(raw, raw + strlen(raw), 0, &b, wl, arena, &quoted);
+
+  if (r == 0 && (b.len > 0 || quoted || wl->count > words_before))
+    r = emit_word(&b, wl, arena);
+
+  free(b.buf);
+  free(b.pat);
+  return r;
+}
+
+/*
+ * Quote and backslash removal only: a $ stays literal (a here-document
+ * delimiter). The result is never longer than raw.
+ */
+char *unquote_word(const char *raw, size_t len, Arena *arena) {
+  const char *end = raw + len;
+  char *text = arena_alloc(arena, len + 1);
+  size_t n = 0;
+  char quote = 0;
+
+  if (!text)
+    return NULL;
+
+  for (const char *p = raw; p < end; p++) {
+    if (quote == '\'') {
+      if (*p == '\'')
+        quote = 0;
+      else
+        text[n++] = *p;
+    } else if (*p == '\\' && p + 1 < end) {
+      /* Inside double quotes only a few characters can be escaped */
+      if (quote == '"' && !strchr("$`\"\\\n", p[1]))
+        text[n++] = *p;
+      text[n++] = *++p;
+    } else if (quote == '"') {
+      if (*p == '"')
+        quote = 0;
+      else
+        text[n++] = *p;
+    } else if (*p == '"' || *p == '\'') {
+      quote = *p;
+    } else {
+      text[n++] = *p;
+    }
+  }
+  text[n] = '\0';
+  return text;
+}
+
+/*
+ * The last byte of the quoted string, escape or ${...} starting at q,
+ * or q itself if it starts none of them. Brace expansion looks past
+ * these.
+ */
+static const char *skip_literal(const char *q, const char *end) {
+  if (*q == '\\')
+    return q + 1 < end ? q + 1 : q;
+
+  if (*q == '$' && q + 1 < end && q[1] == '{') {
+    const char *close = find_brace_end(q + 1, end);
+    return close ? close : q;
+  }
+
+  if (*q == '"' || *q == '\'') {
+    for (const char *s = q + 1; s < end; s++) {
+      if (*s == *q)
+        return s;
+      if (*s == '\\' && *q == '"' && s + 1 < end)
+        s++;
+    }
+    return end - 1;
+  }
+
+  return q;
+}
+
+/* The } matching the { at open; *comma is set if it holds a top-level , */
+static const char *brace_close(const char *open, const char *end,
+                               int *comma) {
+  int depth = 0;
+
+  *comma = 0;
+  for (const char *q = open + 1; q < end; q++) {
+    const char *next = skip_literal(q, end);
+    if (next != q) {
+      q = next;
+    } else if (*q == '{') {
+      depth++;
+    } else if (*q == '}') {
+      if (depth == 0)
+        return q;
+      depth--;
+    } else if (*q == ',' && depth == 0) {
+      *comma = 1;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Expand the first {a,b,...} in len bytes of raw text s into out, one
+ * word per alternative with the prefix and suffix around it. Each word
+ * is expanded again for the groups that remain. Text without a group
+ * (a lone {, {} or {a}) is a single word.
+ */
+static int brace_expand(const char *s, size_t len, WordList *out,
+                        Arena *arena) {
+  const char *end = s + len;
+
+  for (const char *q = s; q < end; q++) {
+    const char *next = skip_literal(q, end);
+    if (next != q) {
+      q = next;
+      continue;
+    }
+    if (*q != '{')
+      continue;
+
+    int comma;
+    const char *close = brace_close(q, end, &comma);
+    if (!close || !comma)
+      continue;
+
+    size_t prefix_len = q - s;
+    size_t suffix_len = end - (close + 1);
+    const char *alt = q + 1;
+    int depth = 0;
+
+    for (const char *a = q + 1; a <= close; a++) {
+      next = a < close ? skip_literal(a, close) : a;
+      if (next != a) {
+        a = next;
+      } else if (a == close || (*a == ',' && depth == 0)) {
+        size_t alt_len = a - alt;
+        size_t word_len = prefix_len + alt_len + suffix_len;
+        char *word = arena_alloc(arena, word_len + 1);
+        if (!word)
+          return -1;
+        memcpy(word, s, prefix_len);
+        memcpy(word + prefix_len, alt, alt_len);
+        memcpy(word + prefix_len + alt_len, close + 1, suffix_len);
+        word[word_len] = '\0';
+
+        if (brace_expand(word, word_len, out, arena) < 0)
+          return -1;
+        alt = a + 1;
+      } else if (*a == '{') {
+        depth++;
+      } else if (*a == '}') {
+        depth--;
+      }
+    }
+    return 0;
+  }
+
+  char *word = arena_strndup(arena, s, len);
+  if (!word)
+    return -1;
+  return list_push(out, word, arena);
+}
+
+/* Redirection operators, whose target word is not brace expanded */
+static int takes_filename(TokenKind kind) {
+  return (kind == TOK_REDIR_IN || kind == TOK_REDIR_OUT ||
+          kind == TOK_REDIR_APPEND || kind == TOK_REDIR_ERR ||
+          kind == TOK_HEREDOC || kind == TOK_HEREDOC_STRIP ||
+          kind == TOK_HERESTRING);
+}
+
+/*
+ * Brace expansion over the line's tokens, working on the raw text of
+ * each word so that quoted braces stay literal. A word with a group is
+ * replaced by one raw word per alternative, left for expand_pipeline()
+ * like a word with parameters. Redirection targets are left alone. The
+ * token array is only copied once some word actually expands.
+ */
+int expand_braces(TokenList *list, const char *line, Arena *arena) {
+  Token *tokens = list->tokens;
+  int count = list->count;
+  int cap = count;
+  int copied = 0;
+
+  for (int i = 0; i < list->count; i++) {
+    Token *tok = &list->tokens[i];
+    const char *raw = line + tok->off;
+    WordList wl = {NULL, 0, 0};
+
+    int target = i > 0 && takes_filename(list->tokens[i - 1].kind);
+    if (tok->kind == TOK_WORD && !target && memchr(raw, '{', tok->len)) {
+      if (brace_expand(raw, tok->len, &wl, arena) < 0)
+        return -1;
+    }
+
+    if (wl.count > 1 && !copied) {
+      /* Start a new array holding the tokens before this one */
+      cap = list->count + wl.count;
+      tokens = arena_alloc(arena, cap * sizeof(Token));
+      if (!tokens)
+        return -1;
+      memcpy(tokens, list->tokens, i * sizeof(Token));
+      count = i;
+      copied = 1;
+    }
+    if (!copied)
+      continue;
+
+    int needed = count + (wl.count > 1 ? wl.count : 1);
+    if (needed > cap) {
+      while (cap < needed)
+        cap *= 2;
+      Token *grown = arena_alloc(arena, cap * sizeof(Token));
+      if (!grown)
+        return -1;
+      memcpy(grown, tokens, count * sizeof(Token));
+      tokens = grown;
+    }
+
+    if (wl.count <= 1) {
+      tokens[count++] = *tok;
+      continue;
+    }
+    for (int j = 0; j < wl.count; j++) {
+      Token *word = &tokens[count++];
+      *word = *tok;
+      word->len = strlen(wl.words[j]);
+      word->text = wl.words[j];
+      word->expand = 1;
+    }
+  }
+
+  if (copied) {
+    list->tokens = tokens;
+    list->count = count;
+    list->cap = cap;
+  }
+  return 0;
+}
+
+/*
+ * Expand parameters in a here-document body, which is not a word:
+ * quotes are literal and a backslash only escapes $, `, \ and a
+ * newline, which it removes.
+ */
+static int expand_here_body(Redirection *r, Arena *arena) {
+  WordBuf b = {NULL, 0, 0, NULL, 0, 0, 0};
+  const char *p = r->body;
+  const char *end = r->body + r->body_len;
+  int ret = 0;
+
+  while (p < end && ret == 0) {
+    if (*p == '\\' && p + 1 < end && strchr("$`\\\n", p[1])) {
+      if (p[1] != '\n')
+        ret = buf_put(&b, p + 1, 1);
+      p += 2;
+    } else if (*p == '$') {
+      p++;
+      int found = expand_parameter(&p, end, '"', &b, NULL, arena);
+      if (found < 0)
+        ret = -1;
+      else if (found == 0)
+        ret = buf_put(&b, "$", 1);
+    } else {
+      /* Copy up to the next $ or backslash in one go */
+      const char *run = p + 1;
+      while (run < end && *run != '$' && *run != '\\')
+        run++;
+      ret = buf_put(&b, p, run - p);
+      p = run;
+    }
+  }
+
+  if (ret == 0) {
+    r->body = arena_strndup(arena, b.buf ? b.buf : "", b.len);
+    r->body_len = b.len;
+    ret = r->body ? 0 : -1;
+  }
+
+  free(b.buf);
+  free(b.pat);
+  return ret;
+}
+
+/*
+ * Expand the raw words of every command in the pipeline: arguments,
+ * whose number may change, redirection targets, which must stay one
+ * word, and here-document bodies. Group contents are expanded when they
+ * run.
+ */
+int expand_pipeline(Pipeline *pipeline, Arena *arena) {
+  for (int i = 0; i < pipeline->cmd_count; i++) {
+    Command *cmd = &pipeline->commands[i];
+
+    for (int j = 0; j < cmd->redir_count; j++) {
+      Redirection *r = &cmd->redirs[j];
+      WordList wl = {NULL, 0, 0};
+
+      if (r->expand_body) {
+        if (expand_here_body(r, arena) < 0)
+          return -1;
+        r->expand_body = 0;
+      }
+      if (!r->expand)
+        continue;
+      if (expand_word(r->filename, &wl, arena) < 0)
+        return -1;
+      if (wl.count != 1) {
+        fprintf(stderr, "seal: %s: ambiguous redirect\n", r->filename);
+        return -1;
+      }
+      r->filename = wl.words[0];
+      r->expand = 0;
+    }
+
+    if (!cmd->expand)
+      continue;
+
+    WordList wl = {NULL, 0, 0};
+    int sub = 0;
+
+    for (int j = 0; j < cmd->argc; j++) {
+      /* Process substitutions follow their argument to its new slot */
+      if (sub < cmd->procsub_count && cmd->procsubs[sub].arg == j)
+        cmd->procsubs[sub++].arg = wl.count;
+
+      int r = cmd->expand[j] ? expand_word(cmd->argv[j], &wl, arena)
+                             : list_push(&wl, cmd->argv[j], arena);
+      if (r < 0)
+        return -1;
+    }
+
+    /* Nothing left: the null command still applies the redirections */
+    if (wl.count == 0 && list_push(&wl, ":", arena) < 0)
+      return -1;
+
+    int argc = wl.count;
+    if (list_push(&wl, NULL, arena) < 0)
+      return -1;
+
+    cmd->argv = wl.words;
+    cmd->argc = argc;
+    cmd->expand = NULL;
+  }
+
+  return 0;
+}
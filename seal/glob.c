@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/*
+ * Pathname expansion: *, ? and [...].
+ *
+ * A pattern is matched one path component at a time; components without
+ * glob characters are taken as they are. Directories are read with
+ * openat() and getdents64(), and each listing is kept, keyed by device
+ * and inode, until the next command line starts, so two patterns in one
+ * directory read it once and a cd in between still sees the right one.
+ * Names are compared with fnmatch(); a leading dot has to be matched
+ * explicitly. Matches are sorted unless set +o globsort.
+ *
+ * Listings are allocated from the line's arena, which is reset along
+ * with the cache.
+ */
+
+#define DENTS_BUF_SIZE 32768
+
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/* One cached directory listing */
+typedef struct DirListing {
+  dev_t dev;               /* Directory identity */
+  ino_t ino;
+  char **names;            /* Entries, without . and .. */
+  int count;               /* Number of entries */
+  struct DirListing *next; /* Next cached directory */
+} DirListing;
+
+static DirListing *dir_cache = NULL;
+
+/* Matches collected for one pattern */
+typedef struct {
+  char **paths; /* Matching paths (arena) */
+  int count;    /* Number of matches */
+  int cap;      /* Allocated slots */
+  Arena *arena; /* The line's arena */
+} GlobMatches;
+
+/* Forget every listing; called when a new command line starts */
+void glob_cache_reset(void) { dir_cache = NULL; }
+
+/* Read dir (relative to the current directory) or return its listing */
+static DirListing *read_dir(const char *dir, Arena *arena) {
+  static char buf[DENTS_BUF_SIZE] __attribute__((aligned(8)));
+  struct stat st;
+  int cap = 0;
+
+  int fd = openat(AT_FDCWD, *dir ? dir : ".",
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  for (DirListing *l = dir_cache; l; l = l->next) {
+    if (l->dev == st.st_dev && l->ino == st.st_ino) {
+      close(fd);
+      return l;
+    }
+  }
+
+  DirListing *listing = arena_calloc(arena, 1, sizeof(DirListing));
+  if (!listing) {
+    close(fd);
+    return NULL;
+  }
+  listing->dev = st.st_dev;
+  listing->ino = st.st_ino;
+
+  while (1) {
+    long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+    if (n <= 0)
+      break;
+
+    for (long off = 0; off < n;) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+      off += d->d_reclen;
+
+      const char *name = d->d_name;
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+
+      if (listing->count == cap) {
+        int new_cap = cap ? cap * 2 : 32;
+        char **grown = arena_alloc(arena, new_cap * sizeof(char *));
+        if (!grown) {
+          close(fd);
+          return NULL;
+        }
+        if (listing->count > 0)
+          memcpy(grown, listing->names, listing->count * sizeof(char *));
+        listing->names = grown;
+        cap = new_cap;
+      }
+      listing->names[listing->count] = arena_strdup(arena, name);
+      if (!listing->names[listing->count]) {
+        close(fd);
+        return NULL;
+      }
+      listing->count++;
+    }
+  }
+  close(fd);
+
+  listing->next = dir_cache;
+  dir_cache = listing;
+  return listing;
+}
+
+/* Whether len bytes of s hold an unescaped *, ? or [...] */
+static int has_magic(const char *s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] == '\\') {
+      i++;
+    } else if (s[i] == '*' || s[i] == '?') {
+      return 1;
+    } else if (s[i] == '[') {
+      /* A bracket only counts if it is closed */
+      size_t j = i + 1;
+      if (j < len && (s[j] == '!' || s[j] == '^'))
+        j++;
+      if (j < len && s[j] == ']')
+        j++;
+      while (j < len && s[j] != ']' && s[j] != '/')
+        j++;
+      if (j < len && s[j] == ']')
+        return 1;
+    }
+  }
+  return 0;
+}
+
+int is_glob_pattern(const char *pattern) {
+  return has_magic(pattern, strlen(pattern));
+}
+
+static int add_match(GlobMatches *m, char *path) {
+  if (m->count == m->cap) {
+    int cap = m->cap ? m->cap * 2 : 16;
+    char **grown = arena_alloc(m->arena, cap * sizeof(char *));
+    if (!grown)
+      return -1;
+    if (m->count > 0)
+      memcpy(grown, m->paths, m->count * sizeof(char *));
+    m->paths = grown;
+    m->cap = cap;
+  }
+  m->paths[m->count++] = path;
+  return 0;
+}
+
+/* prefix + len bytes of s, with backslash escapes removed if unescape */
+static char *join(const char *prefix, const char *s, size_t len,
+                  int unescape, Arena *arena) {
+  size_t prefix_len = strlen(prefix);
+  char *out = arena_alloc(arena, prefix_len + len + 2);
+  if (!out)
+    return NULL;
+
+  memcpy(out, prefix, prefix_len);
+  size_t n = prefix_len;
+  for (size_t i = 0; i < len; i++) {
+    if (unescape && s[i] == '\\' && i + 1 < len)
+      i++;
+    out[n++] = s[i];
+  }
+  out[n] = '\0';
+  return out;
+}
+
+/* Match rest (the pattern after prefix) and add what exists to m */
+static int glob_from(const char *prefix, const char *rest, GlobMatches *m) {
+  /* Slashes are copied through */
+  if (*rest == '/') {
+    size_t slashes = strspn(rest, "/");
+    char *next = join(prefix, rest, slashes, 0, m->arena);
+    return next ? glob_from(next, rest + slashes, m) : -1;
+  }
+
+  struct stat st;
+  if (*rest == '\0') {
+    /* Only reached after a trailing slash: keep directories */
+    return stat(prefix, &st) == 0 ? add_match(m, (char *)prefix) : 0;
+  }
+
+  const char *slash = strchr(rest, '/');
+  size_t len = slash ? (size_t)(slash - rest) : strlen(rest);
+
+  if (!has_magic(rest, len)) {
+    char *path = join(prefix, rest, len, 1, m->arena);
+    if (!path)
+      return -1;
+    if (slash)
+      return glob_from(path, slash, m);
+    return lstat(path, &st) == 0 ? add_match(m, path) : 0;
+  }
+
+  DirListing *listing = read_dir(prefix, m->arena);
+  if (!listing)
+    return 0;
+
+  char *pattern = arena_strndup(m->arena, rest, len);
+  if (!pattern)
+    return -1;
+
+  for (int i = 0; i < listing->count; i++) {
+    const char *name = listing->names[i];
+    if (fnmatch(pattern, name, FNM_PERIOD) != 0)
+      continue;
+
+    char *path = join(prefix, name, strlen(name), 0, m->arena);
+    if (!path)
+      return -1;
+    int r = slash ? glob_from(path, slash, m) : add_match(m, path);
+    if (r < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Expand pattern (quoted characters escaped with backslashes). Returns
+ * the number of matches, stored in *paths, or -1 on error.
+ */
+int glob_expand(const char *pattern, char ***paths, Arena *arena) {
+  GlobMatches m = {NULL, 0, 0, arena};
+
+  if (glob_from("", pattern, &m) < 0)
+    return -1;
+
+  if (g_shell.glob_sort && m.count > 1)
+    qsort(m.paths, m.count, sizeof(char *), compare_paths);
+
+  *paths = m.paths;
+  return m.count;
+}
@@ -0,0 +1,277 @@
+#include "shell.h"
+#include <sys/stat.h>
+
+/*
+ * Command hash table.
+ *
+ * Maps a command name to the absolute path found by walking $PATH, so
+ * each external command only pays for the PATH search once. Failed
+ * searches are remembered too (path == NULL), which keeps scripts that
+ * probe for missing tools from re-scanning every directory. The whole
+ * table is dropped whenever PATH changes, and an entry whose binary has
+ * disappeared is dropped when spawning it fails with ENOENT.
+ */
+
+#define HASH_INITIAL_BUCKETS 64
+
+typedef struct HashEntry {
+  char *name;             /* Command name (key) */
+  char *path;             /* Resolved path, NULL if not found */
+  unsigned long hits;     /* Lookups served from this entry */
+  struct HashEntry *next; /* Bucket chain */
+} HashEntry;
+
+static HashEntry **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+static unsigned long total_hits = 0;
+static unsigned long total_misses = 0;
+
+static size_t hash_name(const char *name) {
+  /* FNV-1a */
+  size_t h = 2166136261u;
+  while (*name) {
+    h ^= (unsigned char)*name++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int is_executable_file(const char *path) {
+  struct stat st;
+  return (stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+          access(path, X_OK) == 0);
+}
+
+/* Walk $PATH the same way execvp() does. Returns a malloc'd path or NULL. */
+static char *search_path(const char *name) {
+  const char *path_env = var_get("PATH");
+  if (path_env == NULL) {
+    path_env = "/usr/local/bin:/bin:/usr/bin";
+  }
+
+  size_t name_len = strlen(name);
+  const char *dir = path_env;
+
+  while (1) {
+    const char *end = strchr(dir, ':');
+    size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+    /* An empty component means the current directory */
+    char *candidate = malloc(dir_len + name_len + 3);
+    if (!candidate) {
+      perror("malloc");
+      return NULL;
+    }
+    if (dir_len == 0) {
+      memcpy(candidate, "./", 2);
+      memcpy(candidate + 2, name, name_len + 1);
+    } else {
+      memcpy(candidate, dir, dir_len);
+      candidate[dir_len] = '/';
+      memcpy(candidate + dir_len + 1, name, name_len + 1);
+    }
+
+    if (is_executable_file(candidate)) {
+      return candidate;
+    }
+    free(candidate);
+
+    if (!end)
+      break;
+    dir = end + 1;
+  }
+
+  return NULL;
+}
+
+static HashEntry *find_entry(const char *name, size_t h) {
+  if (bucket_count == 0)
+    return NULL;
+
+  HashEntry *e = buckets[h & (bucket_count - 1)];
+  while (e) {
+    if (strcmp(e->name, name) == 0)
+      return e;
+    e = e->next;
+  }
+  return NULL;
+}
+
+static void grow_table(void) {
+  size_t new_count = bucket_count ? bucket_count * 2 : HASH_INITIAL_BUCKETS;
+  HashEntry **new_buckets = calloc(new_count, sizeof(HashEntry *));
+  if (!new_buckets) {
+    perror("calloc");
+    return;
+  }
+
+  for (size_t i = 0; i < bucket_count; i++) {
+    HashEntry *e = buckets[i];
+    while (e) {
+      HashEntry *next = e->next;
+      size_t idx = hash_name(e->name) & (new_count - 1);
+      e->next = new_buckets[idx];
+      new_buckets[idx] = e;
+      e = next;
+    }
+  }
+
+  free(buckets);
+  buckets = new_buckets;
+  bucket_count = new_count;
+}
+
+static HashEntry *insert_entry(const char *name, const char *path) {
+  size_t h = hash_name(name);
+  HashEntry *e = find_entry(name, h);
+
+  if (e) {
+    /* Replace existing mapping */
+    free(e->path);
+    e->path = path ? strdup(path) : NULL;
+    e->hits = 0;
+    return e;
+  }
+
+  if (entry_count >= bucket_count) {
+    grow_table();
+    if (bucket_count == 0)
+      return NULL;
+  }
+
+  e = malloc(sizeof(HashEntry));
+  if (!e) {
+    perror("malloc");
+    return NULL;
+  }
+  e->name = strdup(name);
+  e->path = path ? strdup(path) : NULL;
+  e->hits = 0;
+
+  size_t idx = h & (bucket_count - 1);
+  e->next = buckets[idx];
+  buckets[idx] = e;
+  entry_count++;
+
+  return e;
+}
+
+const char *hash_lookup(const char *name) {
+  /* Names with a slash are never searched for in PATH */
+  if (strchr(name, '/') != NULL) {
+    return name;
+  }
+
+  HashEntry *e = find_entry(name, hash_name(name));
+  if (e) {
+    e->hits++;
+    total_hits++;
+    return e->path;
+  }
+
+  total_misses++;
+  char *path = search_path(name);
+  e = insert_entry(name, path);
+  free(path);
+
+  if (!e)
+    return NULL;
+  e->hits = 1;
+  return e->path;
+}
+
+/* Drop name's entry, e.g. when its binary is gone, so it is searched again */
+void hash_forget(const char *name) {
+  if (bucket_count == 0)
+    return;
+
+  HashEntry **link = &buckets[hash_name(name) & (bucket_count - 1)];
+  while (*link) {
+    HashEntry *e = *link;
+    if (strcmp(e->name, name) == 0) {
+      *link = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+      entry_count--;
+      return;
+    }
+    link = &e->next;
+  }
+}
+
+void hash_clear(void) {
+  for (size_t i = 0; i < bucket_count; i++) {
+    HashEntry *e = buckets[i];
+    while (e) {
+      HashEntry *next = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+      e = next;
+    }
+    buckets[i] = NULL;
+  }
+  entry_count = 0;
+}
+
+static void list_entries(void) {
+  if (entry_count == 0) {
+    printf("hash: hash table empty\n");
+  } else {
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < bucket_count; i++) {
+      for (HashEntry *e = buckets[i]; e; e = e->next) {
+        if (e->path) {
+          printf("%4lu\t%s\n", e->hits, e->path);
+        } else {
+          printf("%4lu\t%s (not found)\n", e->hits, e->name);
+        }
+      }
+    }
+  }
+  printf("lookups: %lu hits, %lu misses\n", total_hits, total_misses);
+}
+
+int builtin_hash(char **argv) {
+  int status = 0;
+  int i = 1;
+
+  if (argv[1] == NULL) {
+    list_entries();
+    return 0;
+  }
+
+  if (strcmp(argv[1], "-r") == 0) {
+    hash_clear();
+    total_hits = 0;
+    total_misses = 0;
+    return 0;
+  }
+
+  if (strcmp(argv[1], "-p") == 0) {
+    if (argv[2] == NULL || argv[3] == NULL) {
+      print_error("hash: usage: hash -p path name");
+      return -1;
+    }
+    insert_entry(argv[3], argv[2]);
+    return 0;
+  }
+
+  /* hash name... : resolve and remember each name */
+  for (; argv[i] != NULL; i++) {
+    if (strchr(argv[i], '/') != NULL)
+      continue;
+
+    char *path = search_path(argv[i]);
+    insert_entry(argv[i], path);
+    if (!path) {
+      fprintf(stderr, "seal: hash: %s: not found\n", argv[i]);
+      status = -1;
+    }
+    free(path);
+  }
+
+  return status;
+}
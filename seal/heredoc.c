@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <sys/mman.h>
+
+/*
+ * Here-documents (<<, <<-) and here-strings (<<<).
+ *
+ * A here-document's body is the input lines after its command line, up
+ * to the delimiter. Bodies are read into the line's arena right after
+ * parsing, so seal -n consumes them too. When no part of the delimiter
+ * is quoted, $ parameters in the body are expanded along with the
+ * pipeline's words (expand.c); a quoted delimiter keeps it literal. A
+ * here-string's word is expanded like any other before it is used.
+ *
+ * Before the pipeline starts, each body is written to a memfd and
+ * rewound, so the command gets a seekable stdin with no temporary file
+ * and no extra process. Without memfd_create() a body that fits in a
+ * pipe buffer goes through a pipe instead.
+ */
+
+#define HERE_PIPE_MAX 65536
+
+static int is_here_redir(RedirType type) {
+  return (type == REDIR_HEREDOC || type == REDIR_HEREDOC_STRIP ||
+          type == REDIR_HERESTRING);
+}
+
+/* Read one here-document body from in, up to the delimiter line */
+static int read_body(Redirection *r, InputSource *in, Arena *arena) {
+  const char *delim = r->filename;
+  size_t delim_len = strlen(delim);
+  int strip = (r->type == REDIR_HEREDOC_STRIP);
+  char *buf = NULL;
+  size_t len = 0;
+  size_t cap = 0;
+
+  while (1) {
+    size_t line_len;
+    const char *line = in ? input_read_raw(in, &line_len) : NULL;
+
+    if (!line) {
+      fprintf(stderr,
+              "seal: warning: here-document delimited by end-of-file "
+              "(wanted `%s')\n",
+              delim);
+      break;
+    }
+
+    /* <<- drops leading tabs, from the delimiter line too */
+    if (strip) {
+      while (line_len > 0 && *line == '\t') {
+        line++;
+        line_len--;
+      }
+    }
+
+    if (line_len == delim_len && memcmp(line, delim, delim_len) == 0)
+      break;
+
+    if (len + line_len + 1 > cap) {
+      size_t grown_cap = cap ? cap * 2 : 256;
+      while (grown_cap < len + line_len + 1)
+        grown_cap *= 2;
+      char *grown = realloc(buf, grown_cap);
+      if (!grown) {
+        perror("realloc");
+        free(buf);
+        return -1;
+      }
+      buf = grown;
+      cap = grown_cap;
+    }
+    memcpy(buf + len, line, line_len);
+    len += line_len;
+    buf[len++] = '\n';
+  }
+
+  r->body = arena_strndup(arena, buf ? buf : "", len);
+  r->body_len = len;
+  free(buf);
+  return r->body ? 0 : -1;
+}
+
+/*
+ * Collect the text of every here-document in the pipeline, including
+ * those inside groups, from in in the order they appear on the line.
+ */
+int read_here_docs(Pipeline *pipeline, InputSource *in, Arena *arena) {
+  for (int i = 0; i < pipeline->cmd_count; i++) {
+    Command *cmd = &pipeline->commands[i];
+
+    /* The group's own redirections come after its contents */
+    for (int k = 0; cmd->group && k < cmd->group->count; k++) {
+      if (read_here_docs(cmd->group->items[k].pipeline, in, arena) < 0)
+        return -1;
+    }
+
+    for (int j = 0; j < cmd->redir_count; j++) {
+      Redirection *r = &cmd->redirs[j];
+
+      if (r->type == REDIR_HEREDOC || r->type == REDIR_HEREDOC_STRIP) {
+        if (read_body(r, in, arena) < 0)
+          return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/* A readable descriptor positioned at the start of data */
+static int open_body(const char *data, size_t len) {
+  int fd = memfd_create("heredoc", MFD_CLOEXEC);
+
+  if (fd >= 0) {
+    if (write_all(fd, data, len) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  /* No memfd: a pipe works as long as the body fits in its buffer */
+  int p[2];
+  if (len > HERE_PIPE_MAX || pipe2(p, O_CLOEXEC) < 0)
+    return -1;
+  if (write_all(p[1], data, len) < 0) {
+    close(p[0]);
+    close(p[1]);
+    return -1;
+  }
+  close(p[1]);
+  return p[0];
+}
+
+/* Open every body for the redirections to dup onto stdin */
+int open_here_docs(Pipeline *pipeline) {
+  for (int i = 0; i < pipeline->cmd_count; i++) {
+    Command *cmd = &pipeline->commands[i];
+
+    for (int j = 0; j < cmd->redir_count; j++) {
+      Redirection *r = &cmd->redirs[j];
+      if (!is_here_redir(r->type))
+        continue;
+
+      /* A here-string is its (by now expanded) word plus a newline */
+      if (r->type == REDIR_HERESTRING) {
+        size_t word_len = strlen(r->filename);
+        r->body = arena_alloc(&g_shell.arena, word_len + 1);
+        if (!r->body) {
+          close_here_docs(pipeline);
+          return -1;
+        }
+        memcpy(r->body, r->filename, word_len);
+        r->body[word_len] = '\n';
+        r->body_len = word_len + 1;
+      }
+
+      r->fd = open_body(r->body, r->body_len);
+      if (r->fd < 0) {
+        perror("here-document");
+        close_here_docs(pipeline);
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/* The children have their own copies once the pipeline is launched */
+void close_here_docs(Pipeline *pipeline) {
+  for (int i = 0; i < pipeline->cmd_count; i++) {
+    Command *cmd = &pipeline->commands[i];
+
+    for (int j = 0; j < cmd->redir_count; j++) {
+      Redirection *r = &cmd->redirs[j];
+      if (r->fd >= 0) {
+        close(r->fd);
+        r->fd = -1;
+      }
+    }
+  }
+}
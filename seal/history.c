@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/*
+ * Command history.
+ *
+ * Interactive lines are appended to $HISTFILE (default ~/.seal_history)
+ * with one writev() on an O_APPEND descriptor, so shells sharing the file
+ * never interleave their lines. At startup the file is only mapped; the
+ * index of line offsets is built the first time an entry is looked up,
+ * so a long history costs nothing until it is used. Searches run
+ * memmem() over the mapped bytes, newest first, and only locate the line
+ * around a hit. Lines entered in this session follow the mapped ones in
+ * a small array of their own.
+ */
+
+#define HISTORY_SEARCH_WINDOW 65536
+
+static const char *map = NULL;     /* History file as it was at startup */
+static size_t map_size = 0;        /* Mapped bytes */
+static size_t *line_starts = NULL; /* Offsets of mapped lines, plus the end */
+static int map_lines = -1;         /* Mapped lines, -1 until indexed */
+static char **session = NULL;      /* Lines added since startup */
+static int session_count = 0;
+static int session_cap = 0;
+static int hist_fd = -1; /* O_APPEND descriptor of the history file */
+
+void history_init(void) {
+  char path_buf[PATH_MAX];
+  const char *path = var_get("HISTFILE");
+  struct stat st;
+
+  if (!path) {
+    const char *home = var_get("HOME");
+    if (!home)
+      return;
+    snprintf(path_buf, sizeof(path_buf), "%s/.seal_history", home);
+    path = path_buf;
+  }
+  /* HISTFILE= keeps the history in memory only */
+  if (!*path)
+    return;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m != MAP_FAILED) {
+        map = m;
+        map_size = st.st_size;
+      }
+    }
+    close(fd);
+  }
+
+  fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return;
+  /* Out of the way of the descriptors redirections use */
+  hist_fd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+  close(fd);
+
+  /* Finish a last line written without its newline */
+  if (hist_fd >= 0 && map && map[map_size - 1] != '\n' &&
+      write(hist_fd, "\n", 1) < 0) {
+    close(hist_fd);
+    hist_fd = -1;
+  }
+}
+
+void history_close(void) {
+  if (map)
+    munmap((void *)map, map_size);
+  map = NULL;
+  map_size = 0;
+  if (hist_fd >= 0)
+    close(hist_fd);
+  hist_fd = -1;
+}
+
+/* Split the mapped file into lines on first use */
+static void build_index(void) {
+  if (map_lines >= 0)
+    return;
+
+  size_t count = 0;
+  for (const char *p = map; p && p < map + map_size; p++) {
+    p = memchr(p, '\n', map + map_size - p);
+    count++;
+    if (!p)
+      break;
+  }
+
+  line_starts = malloc((count + 1) * sizeof(size_t));
+  if (!line_starts) {
+    perror("malloc");
+    map_lines = 0;
+    return;
+  }
+
+  size_t n = 0;
+  size_t off = 0;
+  while (off < map_size) {
+    line_starts[n++] = off;
+    const char *nl = memchr(map + off, '\n', map_size - off);
+    off = nl ? (size_t)(nl - map) + 1 : map_size + 1;
+  }
+  /* Every line ends one byte before the next one starts */
+  line_starts[n] = off;
+  map_lines = n;
+}
+
+int history_count(void) {
+  build_index();
+  return map_lines + session_count;
+}
+
+/* Entry n (0 is the oldest); the text is not NUL-terminated */
+const char *history_entry(int n, size_t *len) {
+  build_index();
+  if (n < 0 || n >= map_lines + session_count)
+    return NULL;
+
+  if (n >= map_lines) {
+    *len = strlen(session[n - map_lines]);
+    return session[n - map_lines];
+  }
+  *len = line_starts[n + 1] - 1 - line_starts[n];
+  return map + line_starts[n];
+}
+
+void history_add(const char *line) {
+  size_t len = strlen(line);
+
+  if (line[strspn(line, " \t")] == '\0')
+    return;
+
+  if (session_count == session_cap) {
+    int cap = session_cap ? session_cap * 2 : 64;
+    char **grown = realloc(session, cap * sizeof(char *));
+    if (!grown) {
+      perror("realloc");
+      return;
+    }
+    session = grown;
+    session_cap = cap;
+  }
+  session[session_count] = strdup(line);
+  if (!session[session_count])
+    return;
+  session_count++;
+
+  if (hist_fd >= 0) {
+    /* One write with O_APPEND: other shells' lines land before or after */
+    struct iovec iov[2] = {{(void *)line, len}, {"\n", 1}};
+    if (writev(hist_fd, iov, 2) < 0) {
+      close(hist_fd);
+      hist_fd = -1;
+    }
+  }
+}
+
+/* Offset of the last needle in map[0, end), scanning back by windows */
+static long last_match(const char *needle, size_t len, size_t end) {
+  size_t window = HISTORY_SEARCH_WINDOW;
+  size_t hi = end;
+
+  if (window < 2 * len)
+    window = 2 * len;
+
+  while (hi >= len) {
+    size_t lo = hi > window ? hi - window : 0;
+    const char *found = NULL;
+    const char *p = map + lo;
+
+    while ((p = memmem(p, map + hi - p, needle, len)) != NULL) {
+      found = p;
+      p++;
+    }
+    if (found)
+      return found - map;
+    if (lo == 0)
+      break;
+    /* Overlap so a match across the window edge is still seen */
+    hi = lo + len - 1;
+  }
+  return -1;
+}
+
+/*
+ * The newest entry before entry number before that contains needle, or
+ * -1. Calling it again with the result walks further back.
+ */
+int history_search(const char *needle, int before) {
+  size_t len = strlen(needle);
+
+  build_index();
+  if (before > map_lines + session_count)
+    before = map_lines + session_count;
+
+  for (int n = before - 1; n >= map_lines; n--) {
+    if (strstr(session[n - map_lines], needle))
+      return n;
+  }
+  if (before > map_lines)
+    before = map_lines;
+  if (before <= 0 || memchr(needle, '\n', len))
+    return -1;
+  if (len == 0)
+    return before - 1;
+
+  long off = last_match(needle, len, line_starts[before] - 1);
+  if (off < 0)
+    return -1;
+
+  /* The line holding the hit: the last one starting at or before it */
+  int lo = 0;
+  int hi = before - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (line_starts[mid] <= (size_t)off)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+int builtin_history(char **argv) {
+  int count = history_count();
+  int first = 0;
+  size_t len;
+
+  /* history -f text: matching entries, newest first */
+  if (argv[1] && strcmp(argv[1], "-f") == 0) {
+    if (!argv[2]) {
+      print_error("history: usage: history -f text");
+      return -1;
+    }
+    for (int n = history_search(argv[2], count); n >= 0;
+         n = history_search(argv[2], n)) {
+      const char *text = history_entry(n, &len);
+      printf("%5d  %.*s\n", n + 1, (int)len, text);
+    }
+    return 0;
+  }
+
+  if (argv[1]) {
+    char *end;
+    long last = strtol(argv[1], &end, 10);
+    if (*end || end == argv[1] || last < 0) {
+      fprintf(stderr, "seal: history: %s: numeric argument required\n",
+              argv[1]);
+      return -1;
+    }
+    if (last < count)
+      first = count - last;
+  }
+
+  for (int n = first; n < count; n++) {
+    const char *text = history_entry(n, &len);
+    printf("%5d  %.*s\n", n + 1, (int)len, text);
+  }
+  return 0;
+}
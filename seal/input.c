@@ -0,0 +1,311 @@
+#include "shell.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Input sources.
+ *
+ * Script files are mapped into memory once and split into lines with
+ * memchr(), so a long batch script costs one open + mmap instead of a
+ * read() per stdio buffer. -c strings use the same in-memory path. Stdin
+ * is read without stdio, so a command that shares it starts right after
+ * the line that ran it: a seekable file is read in blocks and the offset
+ * put back after each line, a pipe one byte at a time, as sh does. The
+ * terminal goes through the line editor (editor.c), which also shows the
+ * prompts.
+ *
+ * input_read_line() returns logical lines: a trailing backslash joins the
+ * next line and an unterminated quote keeps reading until it closes.
+ */
+
+#define INPUT_INITIAL_SIZE 256
+#define STREAM_CHUNK 4096
+#define PROMPT "seal> "
+#define CONTINUATION_PROMPT "> "
+
+int input_open_file(InputSource *in, const char *path) {
+  struct stat st;
+
+  memset(in, 0, sizeof(InputSource));
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    close(fd);
+    errno = EISDIR;
+    return -1;
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      in->data = map;
+      in->size = st.st_size;
+      in->mapped = 1;
+      close(fd);
+      return 0;
+    }
+  }
+
+  /* Pipes, devices and empty files: slurp the whole thing */
+  size_t cap = S_ISREG(st.st_mode) ? (size_t)st.st_size + 1 : 65536;
+  char *buf = malloc(cap);
+  size_t len = 0;
+  ssize_t n;
+
+  if (!buf) {
+    close(fd);
+    return -1;
+  }
+
+  while (1) {
+    if (len == cap) {
+      char *grown = realloc(buf, cap * 2);
+      if (!grown) {
+        free(buf);
+        close(fd);
+        return -1;
+      }
+      buf = grown;
+      cap *= 2;
+    }
+
+    n = read(fd, buf + len, cap - len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      free(buf);
+      close(fd);
+      return -1;
+    }
+    if (n == 0)
+      break;
+    len += n;
+  }
+
+  close(fd);
+  in->data = buf;
+  in->size = len;
+  in->owned = 1;
+  return 0;
+}
+
+void input_open_string(InputSource *in, const char *str) {
+  memset(in, 0, sizeof(InputSource));
+  in->data = str;
+  in->size = strlen(str);
+}
+
+void input_open_stream(InputSource *in, FILE *stream) {
+  memset(in, 0, sizeof(InputSource));
+  in->stream = stream;
+}
+
+void input_close(InputSource *in) {
+  if (in->mapped) {
+    munmap((void *)in->data, in->size);
+  } else if (in->owned) {
+    free((void *)in->data);
+  }
+  free(in->line);
+  free(in->stream_buf);
+  memset(in, 0, sizeof(InputSource));
+}
+
+/*
+ * Read one line from the stream into stream_buf and consume nothing
+ * after it. Returns its length with the newline, or -1 at end of input.
+ */
+static ssize_t read_stream_line(InputSource *in) {
+  int fd = fileno(in->stream);
+  int seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+  size_t len = 0;
+
+  while (1) {
+    size_t want = seekable ? STREAM_CHUNK : 1;
+
+    if (len + want > in->stream_cap) {
+      size_t cap = in->stream_cap ? in->stream_cap : INPUT_INITIAL_SIZE;
+      while (cap < len + want)
+        cap *= 2;
+      char *grown = realloc(in->stream_buf, cap);
+      if (!grown) {
+        perror("realloc");
+        return -1;
+      }
+      in->stream_buf = grown;
+      in->stream_cap = cap;
+    }
+
+    ssize_t n = read(fd, in->stream_buf + len, want);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return len > 0 ? (ssize_t)len : -1;
+
+    char *nl = memchr(in->stream_buf + len, '\n', n);
+    len += n;
+    if (nl) {
+      /* Hand back what was read past the newline */
+      size_t end = nl - in->stream_buf + 1;
+      if (len > end)
+        lseek(fd, (off_t)end - (off_t)len, SEEK_CUR);
+      return end;
+    }
+  }
+}
+
+/*
+ * Next physical line (without its newline), or NULL at end of input. An
+ * interactive shell shows prompt first.
+ */
+static const char *next_physical_line(InputSource *in, size_t *len,
+                                      const char *prompt) {
+  if (in->stream) {
+    if (g_shell.is_interactive && g_shell.line_edit)
+      return edit_line(prompt, len);
+    if (g_shell.is_interactive) {
+      fputs(prompt, stdout);
+      fflush(stdout);
+    }
+
+    ssize_t n = read_stream_line(in);
+    if (n < 0)
+      return NULL;
+    if (n > 0 && in->stream_buf[n - 1] == '\n')
+      n--;
+    *len = n;
+    return in->stream_buf;
+  }
+
+  if (in->pos >= in->size)
+    return NULL;
+
+  const char *start = in->data + in->pos;
+  const char *nl = memchr(start, '\n', in->size - in->pos);
+  if (nl) {
+    *len = nl - start;
+    in->pos += *len + 1;
+  } else {
+    *len = in->size - in->pos;
+    in->pos = in->size;
+  }
+  return start;
+}
+
+static int append_line(InputSource *in, const char *text, size_t len) {
+  size_t need = in->line_len + len + 2;
+
+  if (need > in->line_cap) {
+    size_t cap = in->line_cap ? in->line_cap : INPUT_INITIAL_SIZE;
+    while (cap < need)
+      cap *= 2;
+    char *grown = realloc(in->line, cap);
+    if (!grown) {
+      perror("realloc");
+      return -1;
+    }
+    in->line = grown;
+    in->line_cap = cap;
+  }
+
+  memcpy(in->line + in->line_len, text, len);
+  in->line_len += len;
+  in->line[in->line_len] = '\0';
+  return 0;
+}
+
+/*
+ * Scan the newly appended part of the line for quoting state. Returns 1
+ * when the line is complete, 0 when it continues on the next physical
+ * line. The scan resumes where the previous call stopped.
+ */
+static int line_is_complete(InputSource *in) {
+  char quote = in->scan_quote;
+  size_t i;
+
+  for (i = in->scan_pos; i < in->line_len; i++) {
+    char c = in->line[i];
+
+    if (quote == '\'') {
+      if (c == '\'')
+        quote = 0;
+    } else if (c == '\\') {
+      if (i + 1 == in->line_len) {
+        /* Backslash-newline: drop both and join the next line */
+        in->line_len--;
+        in->line[in->line_len] = '\0';
+        in->scan_pos = in->line_len;
+        in->scan_quote = quote;
+        return 0;
+      }
+      i++;
+    } else if (quote == '"') {
+      if (c == '"')
+        quote = 0;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == '#' && (i == 0 || in->line[i - 1] == ' ' ||
+                            in->line[i - 1] == '\t')) {
+      /* Rest of the line is a comment */
+      return 1;
+    }
+  }
+
+  in->scan_pos = in->line_len;
+  in->scan_quote = quote;
+
+  if (quote) {
+    /* Newlines inside quotes are part of the word */
+    if (append_line(in, "\n", 1) < 0)
+      return 1;
+    in->scan_pos = in->line_len;
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Next physical line as it is, for a here-document body: no joining and
+ * no quote scanning. Does not touch the current logical line.
+ */
+const char *input_read_raw(InputSource *in, size_t *len) {
+  return next_physical_line(in, len, CONTINUATION_PROMPT);
+}
+
+char *input_read_line(InputSource *in) {
+  const char *text;
+  size_t len;
+
+  in->line_len = 0;
+  in->scan_pos = 0;
+  in->scan_quote = 0;
+
+  text = next_physical_line(in, &len, PROMPT);
+  if (text == NULL)
+    return NULL;
+
+  while (1) {
+    if (append_line(in, text, len) < 0)
+      return NULL;
+
+    if (line_is_complete(in))
+      break;
+
+    text = next_physical_line(in, &len, CONTINUATION_PROMPT);
+    if (text == NULL)
+      break;
+  }
+
+  return in->line;
+}
@@ -1,88 +1,411 @@
 #include "shell.h"
 
+/*
+ * Job table.
+ *
+ * g_shell.jobs is a growable array of Job pointers indexed by job_id - 1.
+ * A freed slot keeps its Job (and its process array) for the next job, and
+ * new jobs take the lowest free id, so steady-state job churn allocates
+ * nothing. Every member process of every job is indexed by pid in an open
+ * addressing hash table, so a status from waitpid() finds its job and
+ * process in O(1).
+ */
+
+#define JOBS_INITIAL_CAP 16
+#define PID_INDEX_INITIAL_CAP 64
+
+/* pid index entry: pid 0 is empty, -1 a deleted slot */
+typedef struct {
+  pid_t pid;
+  Job *job;
+} PidEntry;
+
+static PidEntry *pid_index;
+static size_t pid_cap;   /* Slots, a power of two */
+static size_t pid_used;  /* Live and deleted slots */
+static size_t pid_live;  /* Live slots */
+static int first_free;   /* No free job slot below this index */
+
+static size_t pid_hash(pid_t pid) {
+  uint32_t h = (uint32_t)pid * 2654435761u;
+  return (h ^ (h >> 16)) & (pid_cap - 1);
+}
+
+static int pid_index_insert(pid_t pid, Job *job);
+static PidEntry *pid_index_find(pid_t pid);
+
+/*
+ * Rehash when the live and deleted slots reach the load limit. If most
+ * of them are deleted, job churn rather than live pids filled the table:
+ * rehashing at the same size clears them and leaves at least 3/4 free.
+ * Otherwise the table doubles.
+ */
+static int pid_index_grow(void) {
+  PidEntry *old = pid_index;
+  size_t old_cap = pid_cap;
+  size_t i;
+
+  if (old_cap == 0)
+    pid_cap = PID_INDEX_INITIAL_CAP;
+  else if (pid_live < old_cap / 4)
+    pid_cap = old_cap;
+  else
+    pid_cap = old_cap * 2;
+  pid_index = calloc(pid_cap, sizeof(PidEntry));
+  if (!pid_index) {
+    perror("calloc");
+    pid_index = old;
+    pid_cap = old_cap;
+    return -1;
+  }
+
+  /* Rehash live entries; deleted slots are dropped */
+  pid_used = 0;
+  pid_live = 0;
+  for (i = 0; i < old_cap; i++) {
+    if (old[i].pid > 0)
+      pid_index_insert(old[i].pid, old[i].job);
+  }
+  free(old);
+  return 0;
+}
+
+static int pid_index_insert(pid_t pid, Job *job) {
+  size_t i;
+
+  /* A pid can be reused while an old job still awaits notification */
+  PidEntry *e = pid_index_find(pid);
+  if (e) {
+    e->job = job;
+    return 0;
+  }
+
+  if ((pid_used + 1) * 2 > pid_cap && pid_index_grow() < 0)
+    return -1;
+
+  for (i = pid_hash(pid); pid_index[i].pid > 0; i = (i + 1) & (pid_cap - 1))
+    ;
+  if (pid_index[i].pid == 0)
+    pid_used++;
+  pid_live++;
+  pid_index[i].pid = pid;
+  pid_index[i].job = job;
+  return 0;
+}
+
+static PidEntry *pid_index_find(pid_t pid) {
+  size_t i;
+
+  if (pid_cap == 0)
+    return NULL;
+
+  for (i = pid_hash(pid); pid_index[i].pid != 0; i = (i + 1) & (pid_cap - 1)) {
+    if (pid_index[i].pid == pid)
+      return &pid_index[i];
+  }
+  return NULL;
+}
+
 void init_jobs(void) {
+  g_shell.jobs = NULL;
+  g_shell.job_cap = 0;
+  g_shell.job_count = 0;
+  first_free = 0;
+}
+
+/* Get a free slot (lowest job id), growing the table when it is full */
+static int alloc_slot(void) {
   int i;
-  for (i = 0; i < MAX_JOBS; i++) {
-    g_shell.jobs[i].job_id = 0;
-    g_shell.jobs[i].pgid = 0;
-    g_shell.jobs[i].command = NULL;
-    g_shell.jobs[i].state = JOB_DONE;
+
+  for (i = first_free; i < g_shell.job_cap; i++) {
+    if (!g_shell.jobs[i] || g_shell.jobs[i]->job_id == 0)
+      break;
   }
-  g_shell.job_count = 0;
+
+  if (i == g_shell.job_cap) {
+    int cap = g_shell.job_cap ? g_shell.job_cap * 2 : JOBS_INITIAL_CAP;
+    Job **grown = realloc(g_shell.jobs, cap * sizeof(Job *));
+    if (!grown) {
+      perror("realloc");
+      return -1;
+    }
+    memset(grown + g_shell.job_cap, 0,
+           (cap - g_shell.job_cap) * sizeof(Job *));
+    g_shell.jobs = grown;
+    g_shell.job_cap = cap;
+  }
+
+  if (!g_shell.jobs[i]) {
+    g_shell.jobs[i] = calloc(1, sizeof(Job));
+    if (!g_shell.jobs[i]) {
+      perror("calloc");
+      return -1;
+    }
+  }
+
+  first_free = i + 1;
+  return i;
 }
 
-int add_job(pid_t pgid, const char *command, JobState state) {
+/*
+ * Register a job with its member processes in pipeline order. command
+ * may be NULL for a foreground job that nobody has listed yet.
+ */
+Job *add_job(pid_t pgid, const pid_t *pids, int count, const char *command,
+             JobState state) {
+  int slot = alloc_slot();
   int i;
 
-  /* Find free slot */
-  for (i = 0; i < MAX_JOBS; i++) {
-    if (g_shell.jobs[i].job_id == 0) {
-      g_shell.jobs[i].job_id = i + 1;
-      g_shell.jobs[i].pgid = pgid;
-      g_shell.jobs[i].command = strdup(command);
-      g_shell.jobs[i].state = state;
-      g_shell.job_count++;
-      return i + 1;
+  if (slot < 0)
+    return NULL;
+
+  Job *job = g_shell.jobs[slot];
+
+  if (count > job->proc_cap) {
+    JobProcess *procs = realloc(job->procs, count * sizeof(JobProcess));
+    if (!procs) {
+      perror("realloc");
+      return NULL;
     }
+    job->procs = procs;
+    job->proc_cap = count;
   }
 
-  print_error("jobs table full");
-  return -1;
+  job->job_id = slot + 1;
+  job->pgid = pgid;
+  job->command = command ? strdup(command) : NULL;
+  job->state = state;
+  job->exit_status = 0;
+  job->proc_count = count;
+  job->token = JOB_TOKEN_NONE;
+  job->quiet = 0;
+
+  for (i = 0; i < count; i++) {
+    job->procs[i].pid = pids[i];
+    job->procs[i].status = 0;
+    job->procs[i].state = state;
+    memset(&job->procs[i].usage, 0, sizeof(struct rusage));
+    pid_index_insert(pids[i], job);
+  }
+
+  g_shell.job_count++;
+  return job;
 }
 
 void remove_job(int job_id) {
-  if (job_id < 1 || job_id > MAX_JOBS)
-    return;
+  Job *job = get_job(job_id);
+  int i;
 
-  int idx = job_id - 1;
-  if (g_shell.jobs[idx].job_id == 0)
+  if (!job)
     return;
 
-  if (g_shell.jobs[idx].command) {
-    free(g_shell.jobs[idx].command);
+  if (job->token != JOB_TOKEN_NONE) {
+    jobserver_release(job->token);
+    job->token = JOB_TOKEN_NONE;
   }
 
-  g_shell.jobs[idx].job_id = 0;
-  g_shell.jobs[idx].pgid = 0;
-  g_shell.jobs[idx].command = NULL;
-  g_shell.jobs[idx].state = JOB_DONE;
+  for (i = 0; i < job->proc_count; i++) {
+    PidEntry *e = pid_index_find(job->procs[i].pid);
+    if (e && e->job == job) {
+      e->pid = -1;
+      pid_live--;
+    }
+  }
+
+  free(job->command);
+  job->command = NULL;
+  job->job_id = 0;
+  job->pgid = 0;
+  job->proc_count = 0;
+  job->state = JOB_DONE;
   g_shell.job_count--;
+
+  if (job_id - 1 < first_free)
+    first_free = job_id - 1;
 }
 
 Job *get_job(int job_id) {
-  if (job_id < 1 || job_id > MAX_JOBS)
+  if (job_id < 1 || job_id > g_shell.job_cap)
     return NULL;
 
-  int idx = job_id - 1;
-  if (g_shell.jobs[idx].job_id == 0)
+  Job *job = g_shell.jobs[job_id - 1];
+  if (!job || job->job_id == 0)
     return NULL;
 
-  return &g_shell.jobs[idx];
+  return job;
+}
+
+Job *find_job_by_pid(pid_t pid) {
+  PidEntry *e = pid_index_find(pid);
+  return e ? e->job : NULL;
 }
 
 Job *find_job_by_pgid(pid_t pgid) {
+  Job *job = find_job_by_pid(pgid);
+  return (job && job->pgid == pgid) ? job : NULL;
+}
+
+/* Most recent job; with stopped_only, the most recent stopped one */
+Job *find_last_job(int stopped_only) {
   int i;
-  for (i = 0; i < MAX_JOBS; i++) {
-    if (g_shell.jobs[i].job_id != 0 && g_shell.jobs[i].pgid == pgid) {
-      return &g_shell.jobs[i];
+  for (i = g_shell.job_cap - 1; i >= 0; i--) {
+    Job *job = g_shell.jobs[i];
+    if (job && job->job_id != 0 && !job->quiet &&
+        (!stopped_only || job->state == JOB_STOPPED)) {
+      return job;
     }
   }
   return NULL;
 }
 
-void update_job_state(pid_t pgid, JobState state) {
-  Job *job = find_job_by_pgid(pgid);
-  if (job) {
-    job->state = state;
+static int status_code(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  if (WIFSTOPPED(status))
+    return 128 + WSTOPSIG(status);
+  return 0;
+}
+
+/* Derive the job state from its processes */
+static void refresh_job_state(Job *job) {
+  int running = 0;
+  int stopped = 0;
+  int i;
+
+  for (i = 0; i < job->proc_count; i++) {
+    if (job->procs[i].state == JOB_RUNNING)
+      running = 1;
+    else if (job->procs[i].state == JOB_STOPPED)
+      stopped = 1;
+  }
+
+  if (running) {
+    job->state = JOB_RUNNING;
+  } else if (stopped) {
+    job->state = JOB_STOPPED;
+  } else {
+    /* A pipeline's status is its last process's */
+    job->state = JOB_DONE;
+
+    /* Its jobserver slot is free as soon as it finishes */
+    if (job->token != JOB_TOKEN_NONE) {
+      jobserver_release(job->token);
+      job->token = JOB_TOKEN_NONE;
+    }
+    if (job->proc_count > 0)
+      job->exit_status =
+          status_code(job->procs[job->proc_count - 1].status);
   }
 }
 
+/*
+ * Record a status and resource usage from wait4() for one process.
+ * Returns the job it belongs to, or NULL for a pid the table doesn't know.
+ */
+Job *update_process_status(pid_t pid, int status, const struct rusage *ru) {
+  Job *job = find_job_by_pid(pid);
+  int i;
+
+  if (!job)
+    return NULL;
+
+  for (i = 0; i < job->proc_count; i++) {
+    JobProcess *p = &job->procs[i];
+    if (p->pid != pid)
+      continue;
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      p->state = JOB_DONE;
+      p->status = status;
+      p->usage = *ru;
+      clock_gettime(CLOCK_MONOTONIC, &p->finished);
+    } else if (WIFSTOPPED(status)) {
+      p->state = JOB_STOPPED;
+      p->status = status;
+    } else if (WIFCONTINUED(status)) {
+      p->state = JOB_RUNNING;
+    }
+    break;
+  }
+
+  refresh_job_state(job);
+  return job;
+}
+
+/* Resume every process that has not finished */
+static void mark_running(Job *job) {
+  int i;
+  for (i = 0; i < job->proc_count; i++) {
+    if (job->procs[i].state == JOB_STOPPED)
+      job->procs[i].state = JOB_RUNNING;
+  }
+  job->state = JOB_RUNNING;
+}
+
+/*
+ * Wait in the foreground until the job finishes or stops. Returns the
+ * exit status of its last process (128+signal if it stopped).
+ */
+int wait_for_job(Job *job) {
+  struct rusage ru;
+  int status;
+  pid_t pid;
+  uint64_t t = trace_begin();
+
+  while (job->state == JOB_RUNNING) {
+    pid = wait4(-job->pgid, &status, WUNTRACED, &ru);
+
+    if (pid < 0) {
+      if (errno == EINTR) {
+        /* Interrupted by signal, continue */
+        continue;
+      }
+      if (errno != ECHILD) {
+        perror("wait4");
+      }
+      /* Nothing left to wait for: whatever wasn't seen is gone */
+      int i;
+      for (i = 0; i < job->proc_count; i++) {
+        if (job->procs[i].state != JOB_DONE) {
+          job->procs[i].state = JOB_DONE;
+          clock_gettime(CLOCK_MONOTONIC, &job->procs[i].finished);
+        }
+      }
+      refresh_job_state(job);
+      break;
+    }
+
+    update_process_status(pid, status, &ru);
+  }
+  trace_end("wait", t, NULL);
+
+  /* Give terminal back to shell */
+  if (g_shell.is_interactive) {
+    t = trace_begin();
+    tcsetpgrp(g_shell.shell_terminal, g_shell.shell_pgid);
+    trace_end("tcsetpgrp", t, "shell");
+  }
+
+  if (job->state == JOB_STOPPED) {
+    int i;
+    for (i = 0; i < job->proc_count; i++) {
+      if (job->procs[i].state == JOB_STOPPED)
+        return status_code(job->procs[i].status);
+    }
+  }
+
+  return job->exit_status;
+}
+
 void list_jobs(void) {
   int i;
-  for (i = 0; i < MAX_JOBS; i++) {
-    if (g_shell.jobs[i].job_id != 0) {
+  for (i = 0; i < g_shell.job_cap; i++) {
+    Job *job = g_shell.jobs[i];
+    if (job && job->job_id != 0 && !job->quiet) {
       const char *state_str;
-      switch (g_shell.jobs[i].state) {
+      switch (job->state) {
       case JOB_RUNNING:
         state_str = "Running";
         break;
@@ -96,8 +419,8 @@ void list_jobs(void) {
         state_str = "Unknown";
       }
 
-      printf("[%d]  %s\t\t%s\n", g_shell.jobs[i].job_id, state_str,
-             g_shell.jobs[i].command);
+      printf("[%d]  %s\t\t%s\n", job->job_id, state_str,
+             job->command ? job->command : "");
     }
   }
 }
@@ -111,61 +434,30 @@ int bring_job_to_foreground(int job_id, int cont) {
 
   /* Give terminal to job */
   if (g_shell.is_interactive) {
+    uint64_t t = trace_begin();
     tcsetpgrp(g_shell.shell_terminal, job->pgid);
+    trace_end("tcsetpgrp", t, job->command);
   }
 
   /* Continue if stopped */
-  if (cont) {
+  if (cont && job->state == JOB_STOPPED) {
     if (kill(-job->pgid, SIGCONT) < 0) {
       perror("kill");
       return -1;
     }
+    mark_running(job);
   }
 
-  job->state = JOB_RUNNING;
-
   /* Wait for job */
-  int status;
-  pid_t pid;
-
-  while (1) {
-    pid = waitpid(-job->pgid, &status, WUNTRACED);
-
-    if (pid < 0) {
-      if (errno == ECHILD) {
-        /* Job finished */
-        remove_job(job_id);
-        break;
-      }
-      if (errno == EINTR) {
-        continue;
-      }
-      perror("waitpid");
-      break;
-    }
-
-    if (WIFSTOPPED(status)) {
-      /* Job stopped */
-      job->state = JOB_STOPPED;
-      printf("\n[%d]+ Stopped %s\n", job_id, job->command);
-      break;
-    }
+  int status = wait_for_job(job);
 
-    if (WIFEXITED(status) || WIFSIGNALED(status)) {
-      /* Check if all processes done */
-      if (waitpid(-job->pgid, &status, WNOHANG) <= 0) {
-        remove_job(job_id);
-        break;
-      }
-    }
-  }
-
-  /* Give terminal back to shell */
-  if (g_shell.is_interactive) {
-    tcsetpgrp(g_shell.shell_terminal, g_shell.shell_pgid);
+  if (job->state == JOB_STOPPED) {
+    printf("\n[%d]+ Stopped %s\n", job_id, job->command);
+  } else {
+    remove_job(job_id);
   }
 
-  return 0;
+  return status;
 }
 
 int send_job_to_background(int job_id, int cont) {
@@ -183,7 +475,87 @@ int send_job_to_background(int job_id, int cont) {
     printf("[%d]+ %s &\n", job_id, job->command);
   }
 
-  job->state = JOB_RUNNING;
+  mark_running(job);
 
   return 0;
 }
+
+/* Report and forget finished jobs. Called before each prompt. */
+void notify_jobs(void) {
+  int i;
+  for (i = 0; i < g_shell.job_cap; i++) {
+    Job *job = g_shell.jobs[i];
+    if (job && job->job_id != 0 && job->state == JOB_DONE) {
+      if (g_shell.is_interactive && !job->quiet) {
+        printf("[%d]+ Done\t\t%s\n", job->job_id, job->command);
+      }
+      remove_job(job->job_id);
+    }
+  }
+}
+
+/*
+ * Block until the job is no longer running. Returns its exit status, or
+ * WAIT_INTERRUPTED with the job left running if Ctrl-C ended the wait.
+ */
+int wait_job(int job_id) {
+  Job *job = get_job(job_id);
+  int status;
+
+  if (!job) {
+    print_error("wait: no such job");
+    return 127;
+  }
+
+  while (job->state == JOB_RUNNING) {
+    int r = wait_for_child_or_interrupt();
+    if (r < 0)
+      return 1;
+    if (r == 0)
+      return WAIT_INTERRUPTED;
+    reap_children();
+  }
+
+  if (job->state == JOB_STOPPED)
+    return 128 + SIGTSTP;
+
+  status = job->exit_status;
+  remove_job(job_id);
+  return status;
+}
+
+/*
+ * Block until any background job finishes (wait -n). Returns its exit
+ * status, 127 if there is nothing to wait for, or WAIT_INTERRUPTED.
+ */
+int wait_any_job(void) {
+  int i;
+
+  while (1) {
+    int running = 0;
+
+    reap_children();
+
+    for (i = 0; i < g_shell.job_cap; i++) {
+      Job *job = g_shell.jobs[i];
+      if (!job || job->job_id == 0)
+        continue;
+      if (job->state == JOB_DONE) {
+        int status = job->exit_status;
+        remove_job(job->job_id);
+        return status;
+      }
+      if (job->state == JOB_RUNNING)
+        running = 1;
+    }
+
+    if (!running)
+      return 127;
+
+    int r = wait_for_child_or_interrupt();
+    if (r < 0)
+      return 1;
+    if (r == 0)
+      return WAIT_INTERRUPTED;
+  }
+}
@@ -0,0 +1,225 @@
+#include "shell.h"
+#include <sys/epoll.h>
+
+/*
+ * GNU make jobserver.
+ *
+ * A jobserver is a pipe (or, since make 4.4, a fifo) holding one byte
+ * per free job slot; every participant also owns one implicit slot.
+ * Seal joins the jobserver named in an inherited MAKEFLAGS, and
+ * "set -o jobserver=N" makes it one itself: it creates the pipe, fills
+ * it with N-1 tokens and exports MAKEFLAGS so that make, and nested
+ * seals, started from it draw from the same pool.
+ *
+ * Each background job takes a slot before it is launched and gives it
+ * back when it finishes. Waiting for a token also watches the child
+ * event loop, since the token may come from one of our own jobs.
+ */
+
+static int js_read = -1;      /* Our own non-blocking read description */
+static int js_write = -1;     /* Write end, shared with the jobserver */
+static int js_implicit_free;  /* The implicit slot is unused */
+static int js_pipe[2] = {-1, -1}; /* Pipe we created as the server */
+static char *js_saved_makeflags;  /* MAKEFLAGS before we became a server */
+static int js_was_server;
+
+/*
+ * The inherited read end is shared with make, so it can't be switched to
+ * O_NONBLOCK in place. Reopening it through /proc gives a separate open
+ * file description of the same pipe.
+ */
+static int open_read_end(int fd) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+static void attach(int rfd, int wfd) {
+  js_read = rfd;
+  js_write = wfd;
+  js_implicit_free = 1;
+}
+
+/* Join the jobserver described by MAKEFLAGS, if there is a usable one */
+void jobserver_init(void) {
+  const char *flags = var_get("MAKEFLAGS");
+  const char *auth;
+  int rfd, wfd;
+
+  if (!flags)
+    return;
+
+  auth = strstr(flags, "--jobserver-auth=");
+  if (auth) {
+    auth += strlen("--jobserver-auth=");
+  } else if ((auth = strstr(flags, "--jobserver-fds=")) != NULL) {
+    auth += strlen("--jobserver-fds=");
+  } else {
+    return;
+  }
+
+  if (strncmp(auth, "fifo:", 5) == 0) {
+    /* make 4.4 named fifo */
+    char path[4096];
+    size_t len = strcspn(auth + 5, " ");
+    if (len >= sizeof(path))
+      return;
+    memcpy(path, auth + 5, len);
+    path[len] = '\0';
+
+    rfd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (rfd < 0)
+      return;
+    wfd = open(path, O_WRONLY | O_CLOEXEC);
+    if (wfd < 0) {
+      close(rfd);
+      return;
+    }
+    attach(rfd, wfd);
+    return;
+  }
+
+  /* Inherited pipe: "R,W". make closes it for non-recursive commands. */
+  if (sscanf(auth, "%d,%d", &rfd, &wfd) != 2)
+    return;
+  if (fcntl(rfd, F_GETFD) < 0 || fcntl(wfd, F_GETFD) < 0)
+    return;
+
+  int own = open_read_end(rfd);
+  if (own < 0)
+    return;
+  attach(own, wfd);
+}
+
+int jobserver_active(void) { return js_read >= 0; }
+
+/* Stop being a jobserver (or a client of one) */
+void jobserver_stop(void) {
+  if (js_read >= 0)
+    close(js_read);
+  js_read = -1;
+  js_write = -1;
+
+  if (js_was_server) {
+    close(js_pipe[0]);
+    close(js_pipe[1]);
+    js_pipe[0] = js_pipe[1] = -1;
+
+    if (js_saved_makeflags) {
+      var_set("MAKEFLAGS", js_saved_makeflags, 1);
+      free(js_saved_makeflags);
+      js_saved_makeflags = NULL;
+    } else {
+      var_unset("MAKEFLAGS");
+    }
+    js_was_server = 0;
+  }
+}
+
+/* Become a jobserver with the given number of slots */
+int jobserver_start(int slots) {
+  char flags[128];
+  int i;
+
+  jobserver_stop();
+
+  /* Not close-on-exec: make and nested shells inherit both ends */
+  if (pipe(js_pipe) < 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  for (i = 0; i < slots - 1; i++) {
+    if (write(js_pipe[1], "+", 1) != 1) {
+      perror("jobserver");
+      break;
+    }
+  }
+
+  int own = open_read_end(js_pipe[0]);
+  if (own < 0) {
+    perror("jobserver");
+    close(js_pipe[0]);
+    close(js_pipe[1]);
+    js_pipe[0] = js_pipe[1] = -1;
+    return -1;
+  }
+
+  const char *old = var_get("MAKEFLAGS");
+  js_saved_makeflags = old ? strdup(old) : NULL;
+  snprintf(flags, sizeof(flags), " -j%d --jobserver-auth=%d,%d", slots,
+           js_pipe[0], js_pipe[1]);
+  var_set("MAKEFLAGS", flags, 1);
+
+  js_was_server = 1;
+  attach(own, js_pipe[1]);
+  return 0;
+}
+
+/*
+ * Take a slot for a background job. Returns the token byte,
+ * JOB_TOKEN_IMPLICIT, JOB_TOKEN_NONE when there is no jobserver, or
+ * JOB_TOKEN_INTERRUPTED (holding nothing) if Ctrl-C ended the wait.
+ */
+int jobserver_acquire(void) {
+  struct epoll_event ev;
+  int token = JOB_TOKEN_NONE;
+
+  if (js_read < 0)
+    return JOB_TOKEN_NONE;
+
+  if (js_implicit_free) {
+    js_implicit_free = 0;
+    return JOB_TOKEN_IMPLICIT;
+  }
+
+  /* Wake for a token or for a child (which may free one) */
+  ensure_event_set();
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = js_read;
+  epoll_ctl(g_shell.event_fd, EPOLL_CTL_ADD, js_read, &ev);
+
+  while (1) {
+    unsigned char c;
+    ssize_t n = read(js_read, &c, 1);
+
+    if (n == 1) {
+      token = c;
+      break;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      /* The jobserver went away: run unthrottled */
+      break;
+    }
+
+    reap_children();
+    if (js_implicit_free) {
+      js_implicit_free = 0;
+      token = JOB_TOKEN_IMPLICIT;
+      break;
+    }
+
+    int r = wait_for_child_or_interrupt();
+    if (r < 0)
+      break;
+    if (r == 0) {
+      token = JOB_TOKEN_INTERRUPTED;
+      break;
+    }
+  }
+
+  epoll_ctl(g_shell.event_fd, EPOLL_CTL_DEL, js_read, NULL);
+  return token;
+}
+
+/* Give a slot back */
+void jobserver_release(int token) {
+  if (token == JOB_TOKEN_IMPLICIT) {
+    js_implicit_free = 1;
+  } else if (token >= 0 && js_write >= 0) {
+    unsigned char c = (unsigned char)token;
+    while (write(js_write, &c, 1) < 0 && errno == EINTR)
+      ;
+  }
+}
@@ -1,133 +1,292 @@
 #include "shell.h"
 
-static int is_special_char(char c) {
-  return (c == '|' || c == '&' || c == '<' || c == '>' || c == ' ' ||
-          c == '\t' || c == '\n');
+/*
+ * Lexer.
+ *
+ * Tokens are (kind, offset, length) slices of the input line. A word that
+ * has no quotes, escapes or parameters is used in place: the byte after
+ * it (a blank or the first byte of an operator that has already been
+ * classified) is overwritten with '\0' and the token text points into the
+ * line. Words with quotes or escapes are unquoted into the arena. Words
+ * with parameters or unquoted glob characters stay raw in place and are
+ * expanded when their pipeline runs (expand.c). The raw bytes of every
+ * word slice are left untouched, so brace expansion can rescan them.
+ */
+
+#define TOKENS_INITIAL_CAP 32
+
+static int is_blank(char c) { return (c == ' ' || c == '\t' || c == '\n'); }
+
+static int is_operator_char(char c) {
+  return (c == '|' || c == '&' || c == '<' || c == '>' || c == ';' ||
+          c == '(' || c == ')');
 }
 
-char **tokenize(const char *line, int *token_count) {
-  char **tokens = malloc(sizeof(char *) * MAX_TOKENS);
-  if (!tokens) {
-    perror("malloc");
-    return NULL;
+/*
+ * Match an operator at p. "2>" and "2>&1" only count at the start of a
+ * word. Returns the operator length, or 0 if p does not start one.
+ */
+static size_t match_operator(const char *p, int word_start, TokenKind *kind) {
+  if (word_start && p[0] == '2' && p[1] == '>') {
+    if (p[2] == '&' && p[3] == '1') {
+      *kind = TOK_REDIR_ERR_OUT;
+      return 4;
+    }
+    *kind = TOK_REDIR_ERR;
+    return 2;
+  }
+
+  switch (p[0]) {
+  case '|':
+    if (p[1] == '|') {
+      *kind = TOK_OR_IF;
+      return 2;
+    }
+    *kind = TOK_PIPE;
+    return 1;
+  case '&':
+    if (p[1] == '&') {
+      *kind = TOK_AND_IF;
+      return 2;
+    }
+    *kind = TOK_AMP;
+    return 1;
+  case ';':
+    *kind = TOK_SEMI;
+    return 1;
+  case '(':
+    *kind = TOK_LPAREN;
+    return 1;
+  case ')':
+    *kind = TOK_RPAREN;
+    return 1;
+  case '<':
+    if (p[1] == '<') {
+      if (p[2] == '<') {
+        *kind = TOK_HERESTRING;
+        return 3;
+      }
+      if (p[2] == '-') {
+        *kind = TOK_HEREDOC_STRIP;
+        return 3;
+      }
+      *kind = TOK_HEREDOC;
+      return 2;
+    }
+    *kind = TOK_REDIR_IN;
+    return 1;
+  case '>':
+    if (p[1] == '>') {
+      *kind = TOK_REDIR_APPEND;
+      return 2;
+    }
+    *kind = TOK_REDIR_OUT;
+    return 1;
+  default:
+    return 0;
   }
+}
+
+/*
+ * Length of the process substitution at p ("<(" or ">(") through its
+ * matching ')', skipping quoted text. Returns 0 if it is unterminated.
+ */
+static size_t match_proc_sub(const char *p) {
+  int depth = 0;
+  char quote = 0;
+
+  for (const char *q = p + 1; *q; q++) {
+    if (quote) {
+      if (*q == quote)
+        quote = 0;
+      else if (*q == '\\' && quote == '"' && q[1])
+        q++;
+    } else if (*q == '\\' && q[1]) {
+      q++;
+    } else if (*q == '"' || *q == '\'') {
+      quote = *q;
+    } else if (*q == '(') {
+      depth++;
+    } else if (*q == ')' && --depth == 0) {
+      return q - p + 1;
+    }
+  }
+  return 0;
+}
+
+static Token *push_token(TokenList *list, Arena *arena, TokenKind kind,
+                         size_t off, size_t len, char *text) {
+  if (list->count == list->cap) {
+    int cap = list->cap ? list->cap * 2 : TOKENS_INITIAL_CAP;
+    Token *grown = arena_alloc(arena, cap * sizeof(Token));
+    if (!grown)
+      return NULL;
+    if (list->count > 0)
+      memcpy(grown, list->tokens, list->count * sizeof(Token));
+    list->tokens = grown;
+    list->cap = cap;
+  }
+
+  Token *tok = &list->tokens[list->count++];
+  tok->kind = kind;
+  tok->off = off;
+  tok->len = len;
+  tok->text = text;
+  tok->expand = 0;
+  tok->quoted = 0;
+  return tok;
+}
+
+/*
+ * The '}' closing the '{' of a ${...} parameter at p, so blanks and
+ * operators inside it stay part of the word. NULL if it is unterminated.
+ */
+static const char *skip_braced_param(const char *p) {
+  int depth = 0;
+  char quote = 0;
+
+  for (const char *q = p; *q; q++) {
+    if (quote) {
+      if (*q == quote)
+        quote = 0;
+      else if (*q == '\\' && quote == '"' && q[1])
+        q++;
+    } else if (*q == '\\' && q[1]) {
+      q++;
+    } else if (*q == '"' || *q == '\'') {
+      quote = *q;
+    } else if (*q == '{') {
+      depth++;
+    } else if (*q == '}' && --depth == 0) {
+      return q;
+    }
+  }
+  return NULL;
+}
 
-  int count = 0;
-  const char *p = line;
-  char buffer[MAX_LINE];
-  int buf_idx = 0;
-  int in_quotes = 0;
-  char quote_char = 0;
+int tokenize(char *line, TokenList *list, Arena *arena) {
+  char *p = line;
+
+  list->tokens = NULL;
+  list->count = 0;
+  list->cap = 0;
 
   while (*p) {
+    TokenKind kind;
+    size_t op_len;
+
     /* Skip leading whitespace */
-    while (*p == ' ' || *p == '\t') {
+    while (is_blank(*p)) {
       p++;
     }
 
     if (*p == '\0')
       break;
 
-    buf_idx = 0;
-    in_quotes = 0;
-
-    while (*p && (in_quotes || !is_special_char(*p) ||
-                  (*p != ' ' && *p != '\t' && *p != '\n'))) {
-      /* Handle quotes */
-      if ((*p == '"' || *p == '\'') && !in_quotes) {
-        in_quotes = 1;
-        quote_char = *p;
-        p++;
-        continue;
-      } else if (*p == quote_char && in_quotes) {
-        in_quotes = 0;
+    /* Comment runs to end of line */
+    if (*p == '#') {
+      while (*p && *p != '\n')
         p++;
-        continue;
-      }
+      continue;
+    }
 
-      /* Handle escape */
-      if (*p == '\\' && *(p + 1)) {
-        p++;
-        buffer[buf_idx++] = *p++;
-        continue;
+    /* Process substitution: the inner command line is kept as text */
+    if ((*p == '<' || *p == '>') && p[1] == '(') {
+      size_t sub_len = match_proc_sub(p);
+      if (sub_len == 0) {
+        print_error("syntax error: unterminated process substitution");
+        return -1;
       }
+      char *text = arena_strndup(arena, p + 2, sub_len - 3);
+      kind = (*p == '<') ? TOK_PROCSUB_IN : TOK_PROCSUB_OUT;
+      if (!text || !push_token(list, arena, kind, p - line, sub_len, text))
+        return -1;
+      p += sub_len;
+      continue;
+    }
 
-      /* Check for special operators */
-      if (!in_quotes) {
-        /* Handle >> */
-        if (*p == '>' && *(p + 1) == '>') {
-          if (buf_idx > 0) {
-            buffer[buf_idx] = '\0';
-            tokens[count++] = strdup(buffer);
-            buf_idx = 0;
-          }
-          tokens[count++] = strdup(">>");
-          p += 2;
-          break;
-        }
-        /* Handle 2> */
-        else if (*p == '2' && *(p + 1) == '>') {
-          if (buf_idx > 0) {
-            buffer[buf_idx] = '\0';
-            tokens[count++] = strdup(buffer);
-            buf_idx = 0;
-          }
-          /* Check for 2>&1 */
-          if (*(p + 2) == '&' && *(p + 3) == '1') {
-            tokens[count++] = strdup("2>&1");
-            p += 4;
-          } else {
-            tokens[count++] = strdup("2>");
-            p += 2;
-          }
-          break;
+    /* Operator */
+    op_len = match_operator(p, 1, &kind);
+    if (op_len > 0) {
+      if (!push_token(list, arena, kind, p - line, op_len, NULL))
+        return -1;
+      p += op_len;
+      continue;
+    }
+
+    /* Word: scan to the next unquoted blank or operator */
+    char *start = p;
+    char quote = 0;
+    int complex = 0;
+    int expand = 0;
+
+    while (*p) {
+      char c = *p;
+
+      if (c == '$' && quote != '\'') {
+        /* Left raw for expand_pipeline(); ${...} is kept whole */
+        expand = 1;
+        if (p[1] == '{') {
+          const char *close = skip_braced_param(p + 1);
+          if (close)
+            p = (char *)close;
         }
-        /* Handle single character operators */
-        else if (*p == '|' || *p == '&' || *p == '<' || *p == '>') {
-          if (buf_idx > 0) {
-            buffer[buf_idx] = '\0';
-            tokens[count++] = strdup(buffer);
-            buf_idx = 0;
-          }
-          buffer[0] = *p;
-          buffer[1] = '\0';
-          tokens[count++] = strdup(buffer);
+      } else if (quote) {
+        if (c == quote) {
+          quote = 0;
+        } else if (c == '\\' && quote == '"' && p[1]) {
           p++;
-          break;
-        }
-        /* Break on whitespace */
-        else if (*p == ' ' || *p == '\t' || *p == '\n') {
-          break;
         }
+      } else if (is_blank(c) || is_operator_char(c)) {
+        break;
+      } else if (c == '"' || c == '\'') {
+        quote = c;
+        complex = 1;
+      } else if (c == '\\') {
+        complex = 1;
+        if (p[1])
+          p++;
+      } else if (c == '*' || c == '?' || c == '[') {
+        /* A possible pattern, matched by expand_pipeline() */
+        expand = 1;
       }
-
-      buffer[buf_idx++] = *p++;
+      p++;
     }
 
-    if (buf_idx > 0) {
-      buffer[buf_idx] = '\0';
-      tokens[count++] = strdup(buffer);
-    }
+    char *end = p;
+    size_t len = end - start;
 
-    if (count >= MAX_TOKENS - 1) {
-      break;
+    /* Classify a directly following operator before touching its byte */
+    op_len = 0;
+    if (*end && is_operator_char(*end)) {
+      op_len = match_operator(end, 0, &kind);
     }
-  }
 
-  tokens[count] = NULL;
-  *token_count = count;
-
-  return tokens;
-}
-
-void free_tokens(char **tokens, int count) {
-  if (!tokens)
-    return;
+    /* Raw and quote-free words are used in place */
+    char *text = start;
+    if (complex && !expand) {
+      text = unquote_word(start, len, arena);
+      if (!text)
+        return -1;
+    }
+    Token *tok = push_token(list, arena, TOK_WORD, start - line, len, text);
+    if (!tok)
+      return -1;
+    tok->expand = expand;
+    tok->quoted = complex;
 
-  for (int i = 0; i < count; i++) {
-    if (tokens[i]) {
-      free(tokens[i]);
+    if (op_len > 0) {
+      if (!push_token(list, arena, kind, end - line, op_len, NULL))
+        return -1;
+      p = end + op_len;
+    } else if (*end) {
+      p = end + 1;
     }
+
+    /* Terminate the word in place; the byte was a blank or an operator */
+    if (*end)
+      *end = '\0';
   }
-  free(tokens);
+
+  return 0;
 }
@@ -3,78 +3,191 @@
 /* Global shell state */
 ShellState g_shell;
 
+static void usage(void) {
+  fprintf(stderr, "usage: seal [-n] [script [args...]]\n"
+                  "       seal [-n] -c command [name [args...]]\n");
+}
+
 int main(int argc, char *argv[]) {
-  char line[MAX_LINE];
-  char **tokens;
-  int token_count;
-  Pipeline *pipeline;
+  InputSource input;
+  const char *command = NULL;
+  const char *script = NULL;
+  int noexec = 0;
+  int argi = 1;
+
+  /* Parse command line */
+  if (argi < argc && strcmp(argv[argi], "-n") == 0) {
+    noexec = 1;
+    argi++;
+  }
+  if (argi < argc && strcmp(argv[argi], "-c") == 0) {
+    if (argi + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    command = argv[argi + 1];
+    argi += 2;
+  } else if (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+    usage();
+    return 2;
+  } else if (argi < argc) {
+    script = argv[argi];
+    argi++;
+  }
 
   /* Initialize shell */
-  init_shell();
+  init_shell(command == NULL && script == NULL);
+  g_shell.noexec = noexec;
 
-  /* Main REPL loop */
+  /* $0 is the script name, or the first argument after -c 'command' */
+  if (script) {
+    g_shell.arg0 = (char *)script;
+  } else if (command && argi < argc) {
+    g_shell.arg0 = argv[argi++];
+  } else {
+    g_shell.arg0 = argv[0];
+  }
+  g_shell.pos_args = argv + argi;
+  g_shell.pos_count = argc - argi;
+
+  /* Select input */
+  if (command) {
+    input_open_string(&input, command);
+  } else if (script) {
+    if (input_open_file(&input, script) < 0) {
+      fprintf(stderr, "seal: %s: %s\n", script, strerror(errno));
+      return 127;
+    }
+  } else {
+    input_open_stream(&input, stdin);
+  }
+
+  /* Main loop */
   while (1) {
-    /* Print prompt */
-    print_prompt();
+    /* Safe point: collect finished children and report done jobs */
+    reap_children();
+    notify_jobs();
 
     /* Read line */
-    if (fgets(line, sizeof(line), stdin) == NULL) {
-      if (feof(stdin)) {
+    uint64_t t = trace_begin();
+    char *line = input_read_line(&input);
+    trace_end("read_line", t, NULL);
+    if (line == NULL) {
+      if (g_shell.is_interactive) {
         printf("\n");
-        break;
       }
-      continue;
+      break;
     }
 
-    /* Trim whitespace */
-    char *trimmed = trim(line);
+    if (g_shell.is_interactive)
+      history_add(line);
 
-    /* Skip empty lines */
-    if (strlen(trimmed) == 0) {
-      continue;
-    }
+    run_line(line, &input);
+  }
 
-    /* Tokenize */
-    tokens = tokenize(trimmed, &token_count);
-    if (tokens == NULL || token_count == 0) {
-      continue;
-    }
+  input_close(&input);
 
-    /* Check for built-in exit */
-    if (strcmp(tokens[0], "exit") == 0) {
-      free_tokens(tokens, token_count);
-      break;
-    }
+  /* Cleanup shell */
+  cleanup_shell();
 
-    /* Parse pipeline */
-    pipeline = parse_pipeline(tokens, token_count);
-    if (pipeline == NULL) {
-      print_error("parse error");
-      free_tokens(tokens, token_count);
-      continue;
-    }
+  return g_shell.last_status;
+}
+
+/*
+ * Run one logical line. in is where it came from, for here-document
+ * bodies that follow it (NULL when there is no more input).
+ */
+int run_line(char *line, InputSource *in) {
+  TokenList tokens;
+  CommandList *list;
 
-    /* Execute pipeline */
-    execute_pipeline(pipeline);
+  /* Trim whitespace */
+  char *trimmed = trim(line);
 
-    /* Cleanup */
-    free_pipeline(pipeline);
-    free_tokens(tokens, token_count);
+  /* Skip empty lines */
+  if (strlen(trimmed) == 0) {
+    return g_shell.last_status;
   }
 
-  /* Cleanup shell */
-  cleanup_shell();
+  /* Directory listings are cached for one line, in its arena */
+  glob_cache_reset();
+
+  /* Tokenize */
+  uint64_t t = trace_begin();
+  int ret = tokenize(trimmed, &tokens, &g_shell.arena);
+  trace_end("tokenize", t, NULL);
+  if (ret < 0 || tokens.count == 0) {
+    arena_reset(&g_shell.arena);
+    return g_shell.last_status;
+  }
 
-  return 0;
+  /* Brace expansion rewrites the raw words before they are parsed */
+  if (expand_braces(&tokens, trimmed, &g_shell.arena) < 0) {
+    arena_reset(&g_shell.arena);
+    g_shell.last_status = 1;
+    return 1;
+  }
+
+  /* Parse command list */
+  t = trace_begin();
+  list = parse_list(&tokens, &g_shell.arena);
+  trace_end("parse_list", t, NULL);
+  if (list == NULL) {
+    print_error("parse error");
+    arena_reset(&g_shell.arena);
+    g_shell.last_status = 2;
+    return 2;
+  }
+
+  /* Here-document bodies follow the line, so read them even with -n */
+  for (int i = 0; i < list->count; i++) {
+    if (read_here_docs(list->items[i].pipeline, in, &g_shell.arena) < 0) {
+      arena_reset(&g_shell.arena);
+      g_shell.last_status = 1;
+      return 1;
+    }
+  }
+
+  /* -n: read and parse only */
+  if (g_shell.noexec) {
+    arena_reset(&g_shell.arena);
+    return g_shell.last_status;
+  }
+
+  execute_list(list);
+
+  /* Release tokens and pipelines in one go */
+  arena_reset(&g_shell.arena);
+
+  return g_shell.last_status;
 }
 
-void init_shell(void) {
+void init_shell(int allow_interactive) {
   /* Initialize shell state */
   memset(&g_shell, 0, sizeof(ShellState));
 
-  /* Check if interactive */
+  /* Shell variables start as a copy of the environment */
+  vars_init();
+
+  /* Pathname expansion sorts its matches unless set +o globsort */
+  g_shell.glob_sort = 1;
+
+  /* Forked copies of the shell compare their pid against this */
+  g_shell.shell_pid = getpid();
+
+  /* Check if interactive (never for scripts and -c) */
   g_shell.shell_terminal = STDIN_FILENO;
-  g_shell.is_interactive = isatty(g_shell.shell_terminal);
+  g_shell.is_interactive =
+      allow_interactive && isatty(g_shell.shell_terminal);
+
+  /* Launch backend: posix_spawn unless SEAL_SPAWN=fork */
+  const char *spawn_mode = getenv("SEAL_SPAWN");
+  g_shell.use_spawn = !(spawn_mode && strcmp(spawn_mode, "fork") == 0);
+
+  /* Pipe capacity between stages: SEAL_PIPESIZE=N[k|m] */
+  const char *pipe_size = getenv("SEAL_PIPESIZE");
+  if (pipe_size && set_pipe_size(pipe_size) < 0)
+    fprintf(stderr, "seal: SEAL_PIPESIZE: %s: invalid size\n", pipe_size);
 
   if (g_shell.is_interactive) {
     /* Loop until we are in the foreground */
@@ -92,7 +205,8 @@ void init_shell(void) {
 
     /* Put ourselves in our own process group */
     g_shell.shell_pgid = getpid();
-    if (setpgid(g_shell.shell_pgid, g_shell.shell_pgid) < 0) {
+    if (getpgrp() != g_shell.shell_pgid &&
+        setpgid(g_shell.shell_pgid, g_shell.shell_pgid) < 0) {
       perror("Couldn't put the shell in its own process group");
       exit(1);
     }
@@ -102,6 +216,13 @@ void init_shell(void) {
 
     /* Save default terminal attributes for shell */
     tcgetattr(g_shell.shell_terminal, &g_shell.shell_tmodes);
+
+    /* Map the history file; it is indexed only when first used */
+    history_init();
+
+    /* Edit lines in raw mode unless the terminal cannot redraw them */
+    const char *term = var_get("TERM");
+    g_shell.line_edit = !(term && strcmp(term, "dumb") == 0);
   }
 
   /* Setup signal handlers */
@@ -109,16 +230,34 @@ void init_shell(void) {
 
   /* Initialize jobs table */
   init_jobs();
+
+  /* Join make's jobserver if started from a recipe */
+  jobserver_init();
+
+  /* Per-line allocator */
+  arena_init(&g_shell.arena);
+  g_shell.held_fds[0] = g_shell.held_fds[1] = -1;
+
+  /* Phase tracing: SEAL_TRACE=/path/to/trace.json */
+  const char *trace_path = getenv("SEAL_TRACE");
+  if (trace_path && *trace_path) {
+    trace_open(trace_path);
+  }
 }
 
 void cleanup_shell(void) {
   int i;
 
-  /* Wait for all jobs to finish or kill them */
-  for (i = 0; i < g_shell.job_count; i++) {
-    if (g_shell.jobs[i].state == JOB_RUNNING ||
-        g_shell.jobs[i].state == JOB_STOPPED) {
-      kill(-g_shell.jobs[i].pgid, SIGTERM);
+  /*
+   * Kill the jobs that are still running. A forked copy (a builtin stage
+   * or a subshell that ran exit) inherited the table but not the jobs,
+   * which belong to the shell.
+   */
+  for (i = 0; g_shell.shell_pid == getpid() && i < g_shell.job_cap; i++) {
+    Job *job = g_shell.jobs[i];
+    if (job && job->job_id != 0 &&
+        (job->state == JOB_RUNNING || job->state == JOB_STOPPED)) {
+      kill(-job->pgid, SIGTERM);
     }
   }
 
@@ -126,11 +265,9 @@ void cleanup_shell(void) {
   if (g_shell.is_interactive) {
     tcsetattr(g_shell.shell_terminal, TCSADRAIN, &g_shell.shell_tmodes);
   }
-}
 
-void print_prompt(void) {
-  if (g_shell.is_interactive) {
-    printf("seal> ");
-    fflush(stdout);
-  }
+  history_close();
+  arena_destroy(&g_shell.arena);
+  trace_close();
 }
+
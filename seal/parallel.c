@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <limits.h>
+#include <sys/mman.h>
+
+/*
+ * parallel [-j N] [-k] [-u] [command [args...]] [::: arg...]
+ *
+ * Runs one task per input line (or per argument after :::), keeping at
+ * most N of them running. With a command, each input replaces {} in its
+ * arguments or is appended as the last one; without, each line is a
+ * command line of its own and runs in a forked copy of the shell.
+ *
+ * Tasks are ordinary background jobs: they are registered in the job
+ * table, reaped by reap_children() and waited for on the shell's child
+ * event loop. Each task's stdout goes to a memfd and is copied out when
+ * the task finishes (-k: in input order; -u: not captured at all).
+ */
+
+typedef struct {
+  char *input;  /* Input line or ::: argument */
+  int job_id;   /* Job while running, 0 once finished */
+  int out_fd;   /* Captured stdout (memfd), -1 if none */
+  int status;   /* Exit status */
+  int done;     /* Finished */
+} Task;
+
+typedef struct {
+  Task *tasks;
+  int count;
+  int cap;
+} TaskList;
+
+/* Buffered line reader on a raw fd, so stdin's FILE is left alone */
+typedef struct {
+  int fd;
+  char buf[4096];
+  size_t len;
+  size_t pos;
+  int eof;
+} LineReader;
+
+static char *read_input_line(LineReader *r) {
+  char *line = NULL;
+  size_t line_len = 0;
+
+  while (1) {
+    if (r->pos == r->len) {
+      ssize_t n;
+      if (r->eof)
+        break;
+      n = read(r->fd, r->buf, sizeof(r->buf));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        r->eof = 1;
+        break;
+      }
+      r->len = n;
+      r->pos = 0;
+    }
+
+    char *start = r->buf + r->pos;
+    char *nl = memchr(start, '\n', r->len - r->pos);
+    size_t chunk = nl ? (size_t)(nl - start) : r->len - r->pos;
+
+    char *grown = realloc(line, line_len + chunk + 1);
+    if (!grown) {
+      free(line);
+      return NULL;
+    }
+    line = grown;
+    memcpy(line + line_len, start, chunk);
+    line_len += chunk;
+    line[line_len] = '\0';
+    r->pos += chunk + (nl ? 1 : 0);
+
+    if (nl)
+      return line;
+  }
+
+  return line;
+}
+
+static Task *add_task(TaskList *list, char *input) {
+  if (list->count == list->cap) {
+    int cap = list->cap ? list->cap * 2 : 64;
+    Task *grown = realloc(list->tasks, cap * sizeof(Task));
+    if (!grown) {
+      perror("realloc");
+      return NULL;
+    }
+    list->tasks = grown;
+    list->cap = cap;
+  }
+
+  Task *t = &list->tasks[list->count++];
+  t->input = input;
+  t->job_id = 0;
+  t->out_fd = -1;
+  t->status = 0;
+  t->done = 0;
+  return t;
+}
+
+/* Build the argv for one input: replace {} or append it */
+static char **build_argv(char **tmpl, const char *input) {
+  int argc = 0;
+  int replaced = 0;
+  int i;
+
+  while (tmpl[argc])
+    argc++;
+
+  char **argv = calloc(argc + 2, sizeof(char *));
+  if (!argv)
+    return NULL;
+
+  for (i = 0; i < argc; i++) {
+    char *brace = strstr(tmpl[i], "{}");
+    if (!brace) {
+      argv[i] = strdup(tmpl[i]);
+    } else {
+      size_t pre = brace - tmpl[i];
+      size_t len = strlen(tmpl[i]) - 2 + strlen(input);
+      argv[i] = malloc(len + 1);
+      if (argv[i])
+        snprintf(argv[i], len + 1, "%.*s%s%s", (int)pre, tmpl[i], input,
+                 brace + 2);
+      replaced = 1;
+    }
+  }
+  if (!replaced)
+    argv[argc++] = strdup(input);
+  argv[argc] = NULL;
+
+  return argv;
+}
+
+static void free_argv(char **argv) {
+  for (char **p = argv; *p; p++)
+    free(*p);
+  free(argv);
+}
+
+static int start_task(Task *t, char **tmpl, int null_fd, int capture) {
+  pid_t pid;
+
+  if (capture) {
+    t->out_fd = memfd_create("parallel", MFD_CLOEXEC);
+    if (t->out_fd < 0) {
+      perror("memfd_create");
+      return -1;
+    }
+  }
+
+  /* Share the make jobserver's slots, if there is one */
+  int token = jobserver_acquire();
+  if (token == JOB_TOKEN_INTERRUPTED) {
+    t->status = WAIT_INTERRUPTED;
+    return -1;
+  }
+
+  /*
+   * Forked into a job of its own (an interactive shell does that), the
+   * tasks join its process group, so Ctrl-C reaches them too
+   */
+  pid_t pgid = g_shell.in_subshell ? getpgrp() : 0;
+
+  if (tmpl) {
+    Command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.argv = build_argv(tmpl, t->input);
+    if (!cmd.argv) {
+      jobserver_release(token);
+      return -1;
+    }
+    while (cmd.argv[cmd.argc])
+      cmd.argc++;
+    cmd.background = 1;
+    pid = launch_process(&cmd, pgid, null_fd, t->out_fd, -1, 0);
+    free_argv(cmd.argv);
+  } else {
+    pid = fork_line(t->input, pgid, null_fd, t->out_fd, -1);
+  }
+
+  if (pid < 0) {
+    jobserver_release(token);
+    return -1;
+  }
+
+  Job *job = add_job(pgid ? pgid : pid, &pid, 1, t->input, JOB_RUNNING);
+  if (!job) {
+    jobserver_release(token);
+    return -1;
+  }
+  job->token = token;
+  t->job_id = job->job_id;
+  return 0;
+}
+
+/* Copy a finished task's captured output to stdout */
+static void flush_task(Task *t) {
+  char buf[8192];
+  ssize_t n;
+
+  if (t->out_fd < 0)
+    return;
+
+  fflush(stdout);
+  lseek(t->out_fd, 0, SEEK_SET);
+  while ((n = read(t->out_fd, buf, sizeof(buf))) > 0) {
+    if (write(STDOUT_FILENO, buf, n) < 0)
+      break;
+  }
+  close(t->out_fd);
+  t->out_fd = -1;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: parallel [-j N] [-k] [-u] [command [args...]] "
+                  "[::: arg...]\n");
+}
+
+int builtin_parallel(char **argv) {
+  long jobs = 0;
+  int keep_order = 0;
+  int capture = 1;
+  char **tmpl = NULL;
+  char **args = NULL;
+  int i = 1;
+
+  /* Options */
+  for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    } else if (strcmp(argv[i], "-j") == 0 && argv[i + 1]) {
+      jobs = atol(argv[++i]);
+    } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+      jobs = atol(argv[i] + 2);
+    } else if (strcmp(argv[i], "-k") == 0) {
+      keep_order = 1;
+    } else if (strcmp(argv[i], "-u") == 0) {
+      capture = 0;
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  /* Default: one per CPU, or as many as the jobserver hands out */
+  if (jobs == 0)
+    jobs = jobserver_active() ? LONG_MAX : sysconf(_SC_NPROCESSORS_ONLN);
+  if (jobs < 1)
+    jobs = 1;
+
+  /* Command template, then ::: arguments */
+  if (argv[i] && strcmp(argv[i], ":::") != 0)
+    tmpl = &argv[i];
+  for (; argv[i]; i++) {
+    if (strcmp(argv[i], ":::") == 0) {
+      args = &argv[i + 1];
+      argv[i] = NULL;
+      break;
+    }
+  }
+
+  int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (null_fd < 0) {
+    perror("/dev/null");
+    return 1;
+  }
+
+  /* Tasks are reaped from the signalfd even in a forked pipeline stage */
+  sigset_t chld, old_mask;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &old_mask);
+
+  TaskList list = {NULL, 0, 0};
+  LineReader reader;
+  reader.fd = STDIN_FILENO;
+  reader.len = reader.pos = 0;
+  reader.eof = 0;
+
+  int running = 0;
+  int next_out = 0; /* -k: first task whose output is not yet written */
+  int first_live = 0;
+  int more = 1;
+  int failed = 0;
+
+  while (more || running > 0) {
+    /* Top up to N running tasks */
+    while (more && running < jobs) {
+      char *input;
+      if (args) {
+        input = *args ? strdup(*args++) : NULL;
+      } else {
+        input = read_input_line(&reader);
+      }
+      if (!input) {
+        more = 0;
+        break;
+      }
+      if (!tmpl && *trim(input) == '\0') {
+        free(input);
+        continue;
+      }
+
+      Task *t = add_task(&list, input);
+      if (!t || start_task(t, tmpl, null_fd, capture) < 0) {
+        /* Ctrl-C while waiting for a slot: start no more tasks */
+        if (t && t->status == WAIT_INTERRUPTED)
+          more = 0;
+        else if (t)
+          t->status = 127;
+        if (t)
+          t->done = 1;
+        continue;
+      }
+      running++;
+    }
+
+    if (running == 0)
+      break;
+
+    /* Sleep on the child event loop, then collect finished tasks */
+    if (wait_for_child_event(-1) < 0)
+      break;
+    reap_children();
+
+    for (int k = first_live; k < list.count; k++) {
+      Task *t = &list.tasks[k];
+      Job *job = t->job_id ? get_job(t->job_id) : NULL;
+
+      if (!job || job->state != JOB_DONE)
+        continue;
+
+      t->status = job->exit_status;
+      t->done = 1;
+      remove_job(t->job_id);
+      t->job_id = 0;
+      running--;
+
+      if (!keep_order)
+        flush_task(t);
+    }
+
+    while (first_live < list.count && list.tasks[first_live].done)
+      first_live++;
+
+    if (keep_order) {
+      while (next_out < list.count && list.tasks[next_out].done)
+        flush_task(&list.tasks[next_out++]);
+    }
+  }
+
+  /* Anything left (-k, or tasks that failed to start) */
+  for (; next_out < list.count; next_out++)
+    flush_task(&list.tasks[next_out]);
+
+  /* Per-task exit status summary */
+  for (i = 0; i < list.count; i++) {
+    if (list.tasks[i].status != 0)
+      failed++;
+  }
+  if (failed > 0) {
+    fprintf(stderr, "parallel: %d of %d tasks failed\n", failed, list.count);
+    for (i = 0; i < list.count; i++) {
+      Task *t = &list.tasks[i];
+      if (t->status != 0)
+        fprintf(stderr, "  #%d exit %d: %s\n", i + 1, t->status, t->input);
+    }
+  }
+
+  for (i = 0; i < list.count; i++)
+    free(list.tasks[i].input);
+  free(list.tasks);
+  close(null_fd);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  /* Like GNU parallel: the number of failed tasks, 101 for more than 100 */
+  return failed > 100 ? 101 : failed;
+}
@@ -1,147 +1,476 @@
 #include "shell.h"
 
-static int is_redir_operator(const char *token) {
-  return (strcmp(token, "<") == 0 || strcmp(token, ">") == 0 ||
-          strcmp(token, ">>") == 0 || strcmp(token, "2>") == 0 ||
-          strcmp(token, "2>&1") == 0);
+static int is_redir_token(TokenKind kind) {
+  return (kind == TOK_REDIR_IN || kind == TOK_REDIR_OUT ||
+          kind == TOK_REDIR_APPEND || kind == TOK_REDIR_ERR ||
+          kind == TOK_REDIR_ERR_OUT || kind == TOK_HEREDOC ||
+          kind == TOK_HEREDOC_STRIP || kind == TOK_HERESTRING);
 }
 
-static RedirType get_redir_type(const char *token) {
-  if (strcmp(token, "<") == 0)
+static int is_proc_sub_token(TokenKind kind) {
+  return (kind == TOK_PROCSUB_IN || kind == TOK_PROCSUB_OUT);
+}
+
+static RedirType get_redir_type(TokenKind kind) {
+  switch (kind) {
+  case TOK_REDIR_IN:
     return REDIR_IN;
-  if (strcmp(token, ">") == 0)
+  case TOK_REDIR_OUT:
     return REDIR_OUT;
-  if (strcmp(token, ">>") == 0)
+  case TOK_REDIR_APPEND:
     return REDIR_APPEND;
-  if (strcmp(token, "2>") == 0)
+  case TOK_REDIR_ERR:
     return REDIR_ERR;
-  if (strcmp(token, "2>&1") == 0)
+  case TOK_REDIR_ERR_OUT:
     return REDIR_ERR_OUT;
-  return REDIR_NONE;
+  case TOK_HEREDOC:
+    return REDIR_HEREDOC;
+  case TOK_HEREDOC_STRIP:
+    return REDIR_HEREDOC_STRIP;
+  case TOK_HERESTRING:
+    return REDIR_HERESTRING;
+  default:
+    return REDIR_NONE;
+  }
 }
 
-Pipeline *parse_pipeline(char **tokens, int token_count) {
-  if (token_count == 0)
-    return NULL;
+static int is_keyword(const Token *tok, const char *word) {
+  return (tok->kind == TOK_WORD && tok->len == strlen(word) &&
+          strcmp(tok->text, word) == 0);
+}
 
-  Pipeline *pipeline = malloc(sizeof(Pipeline));
-  if (!pipeline) {
-    perror("malloc");
+/* Token cursor shared by the recursive parse functions */
+typedef struct {
+  Token *tokens; /* The line's tokens */
+  int count;     /* Number of tokens */
+  int pos;       /* Next token to consume */
+  Arena *arena;  /* The line's arena */
+} Parser;
+
+static Token *peek(Parser *ps) {
+  return ps->pos < ps->count ? &ps->tokens[ps->pos] : NULL;
+}
+
+static int is_list_separator(TokenKind kind) {
+  return (kind == TOK_SEMI || kind == TOK_AMP || kind == TOK_AND_IF ||
+          kind == TOK_OR_IF);
+}
+
+/* A token that ends a simple command's words */
+static int ends_command(TokenKind kind) {
+  return (kind == TOK_PIPE || kind == TOK_LPAREN || kind == TOK_RPAREN ||
+          is_list_separator(kind));
+}
+
+/* The closing ) or } of a group, or the end of the line at the top */
+static int at_list_end(Parser *ps, char closer) {
+  Token *tok = peek(ps);
+  if (!tok)
+    return 1;
+  if (closer == ')')
+    return tok->kind == TOK_RPAREN;
+  if (closer == '}')
+    return is_keyword(tok, "}");
+  return 0;
+}
+
+/* Grow an arena array by doubling; the old copy is left to the arena */
+static void *grow_array(Arena *arena, void *items, int count, int *cap,
+                        size_t size) {
+  if (count < *cap)
+    return items;
+
+  int new_cap = *cap ? *cap * 2 : 4;
+  void *grown = arena_alloc(arena, new_cap * size);
+  if (!grown)
     return NULL;
+  if (count > 0)
+    memcpy(grown, items, count * size);
+  *cap = new_cap;
+  return grown;
+}
+
+static CommandList *parse_list_until(Parser *ps, char closer);
+
+/*
+ * Fill cmd's arguments and redirections from the tokens up to end. After
+ * a group only redirections may follow, so allow_words is 0.
+ *
+ * argv and filenames point straight at the token text, which is either
+ * in the input line or in the line's arena.
+ */
+static int parse_words(Parser *ps, int end, Command *cmd, int allow_words) {
+  Token *tokens = ps->tokens;
+  Arena *arena = ps->arena;
+  int start = ps->pos;
+
+  /* Count arguments and redirections */
+  int argc = 0;
+  int redir_count = 0;
+  int procsub_count = 0;
+  int expand_count = 0;
+
+  for (int j = start; j < end; j++) {
+    if (is_redir_token(tokens[j].kind)) {
+      redir_count++;
+      /* Every redirection except 2>&1 takes a filename */
+      if (tokens[j].kind != TOK_REDIR_ERR_OUT) {
+        j++;
+        if (j >= end || tokens[j].kind != TOK_WORD) {
+          print_error("syntax error: missing filename");
+          return -1;
+        }
+      }
+    } else {
+      if (!allow_words) {
+        print_error("syntax error: unexpected word after group");
+        return -1;
+      }
+      if (is_proc_sub_token(tokens[j].kind))
+        procsub_count++;
+      else if (tokens[j].expand)
+        expand_count++;
+      argc++;
+    }
   }
 
-  /* Count number of commands (separated by |) */
-  int cmd_count = 1;
-  for (int i = 0; i < token_count; i++) {
-    if (strcmp(tokens[i], "|") == 0) {
-      cmd_count++;
+  if (allow_words && argc == 0) {
+    print_error("syntax error: empty command");
+    return -1;
+  }
+
+  /* Allocate argv */
+  if (allow_words) {
+    cmd->argv = arena_alloc(arena, (argc + 1) * sizeof(char *));
+    cmd->argc = argc;
+    if (!cmd->argv) {
+      return -1;
     }
   }
 
-  pipeline->commands = calloc(cmd_count, sizeof(Command));
-  pipeline->cmd_count = cmd_count;
-
-  int cmd_idx = 0;
-  int arg_start = 0;
-  int background = 0;
-
-  for (int i = 0; i <= token_count; i++) {
-    /* Process command at pipe or end */
-    if (i == token_count || strcmp(tokens[i], "|") == 0) {
-      Command *cmd = &pipeline->commands[cmd_idx];
-
-      /* Count arguments and redirections */
-      int argc = 0;
-      int redir_count = 0;
-
-      for (int j = arg_start; j < i; j++) {
-        if (strcmp(tokens[j], "&") == 0) {
-          background = 1;
-        } else if (is_redir_operator(tokens[j])) {
-          redir_count++;
-          j++; /* Skip filename (except for 2>&1) */
-          if (strcmp(tokens[j - 1], "2>&1") != 0) {
-            if (j >= i) {
-              print_error("syntax error: missing filename");
-              free_pipeline(pipeline);
-              return NULL;
-            }
-          }
-        } else {
-          argc++;
-        }
-      }
+  /* Allocate redirections */
+  if (redir_count > 0) {
+    cmd->redirs = arena_calloc(arena, redir_count, sizeof(Redirection));
+    cmd->redir_count = redir_count;
+    if (!cmd->redirs) {
+      return -1;
+    }
+  }
 
-      /* Allocate argv */
-      cmd->argv = calloc(argc + 1, sizeof(char *));
-      cmd->argc = argc;
+  /* Process substitutions are started just before the pipeline runs */
+  if (procsub_count > 0) {
+    cmd->procsubs = arena_calloc(arena, procsub_count, sizeof(ProcSub));
+    cmd->procsub_count = procsub_count;
+    if (!cmd->procsubs) {
+      return -1;
+    }
+  }
 
-      /* Allocate redirections */
-      if (redir_count > 0) {
-        cmd->redirs = calloc(redir_count, sizeof(Redirection));
-        cmd->redir_count = redir_count;
-      }
+  /* Words with parameters or patterns are expanded when the pipeline runs */
+  if (expand_count > 0) {
+    cmd->expand = arena_calloc(arena, argc, 1);
+    if (!cmd->expand) {
+      return -1;
+    }
+  }
+
+  /* Fill argv, redirections and process substitutions */
+  int arg_idx = 0;
+  int redir_idx = 0;
+  int procsub_idx = 0;
 
-      /* Fill argv and redirections */
-      int arg_idx = 0;
-      int redir_idx = 0;
-
-      for (int j = arg_start; j < i; j++) {
-        if (strcmp(tokens[j], "&") == 0) {
-          /* Skip & */
-        } else if (is_redir_operator(tokens[j])) {
-          cmd->redirs[redir_idx].type = get_redir_type(tokens[j]);
-          if (strcmp(tokens[j], "2>&1") != 0) {
-            j++;
-            cmd->redirs[redir_idx].filename = strdup(tokens[j]);
-          } else {
-            cmd->redirs[redir_idx].filename = NULL;
+  for (int j = start; j < end; j++) {
+    if (is_redir_token(tokens[j].kind)) {
+      cmd->redirs[redir_idx].type = get_redir_type(tokens[j].kind);
+      cmd->redirs[redir_idx].fd = -1;
+      if (tokens[j].kind != TOK_REDIR_ERR_OUT) {
+        j++;
+        cmd->redirs[redir_idx].filename = tokens[j].text;
+        /*
+         * Here-document delimiters are only unquoted, never expanded.
+         * Quoting any part of one keeps the body literal.
+         */
+        if (tokens[j - 1].kind == TOK_HEREDOC ||
+            tokens[j - 1].kind == TOK_HEREDOC_STRIP) {
+          cmd->redirs[redir_idx].expand_body = !tokens[j].quoted;
+          if (tokens[j].expand) {
+            cmd->redirs[redir_idx].filename =
+                unquote_word(tokens[j].text, tokens[j].len, arena);
+            if (!cmd->redirs[redir_idx].filename)
+              return -1;
           }
-          redir_idx++;
         } else {
-          cmd->argv[arg_idx++] = strdup(tokens[j]);
+          cmd->redirs[redir_idx].expand = tokens[j].expand;
         }
+      } else {
+        cmd->redirs[redir_idx].filename = NULL;
+      }
+      redir_idx++;
+    } else {
+      if (is_proc_sub_token(tokens[j].kind)) {
+        ProcSub *sub = &cmd->procsubs[procsub_idx++];
+        sub->arg = arg_idx;
+        sub->output = (tokens[j].kind == TOK_PROCSUB_OUT);
+        sub->command = tokens[j].text;
+        sub->fd = -1;
       }
+      if (cmd->expand)
+        cmd->expand[arg_idx] = tokens[j].expand;
+      cmd->argv[arg_idx++] = tokens[j].text;
+    }
+  }
+
+  if (allow_words)
+    cmd->argv[argc] = NULL;
 
-      cmd->argv[argc] = NULL;
-      cmd->background = background;
+  ps->pos = end;
+  return 0;
+}
+
+/*
+ * Parse one pipeline stage: a simple command, or a ( list ) subshell or
+ * { list; } group followed by its redirections.
+ */
+static int parse_command(Parser *ps, Command *cmd) {
+  Token *tok = peek(ps);
+  int end;
+
+  memset(cmd, 0, sizeof(*cmd));
 
-      cmd_idx++;
-      arg_start = i + 1;
+  if (tok && (tok->kind == TOK_LPAREN || is_keyword(tok, "{"))) {
+    char closer = tok->kind == TOK_LPAREN ? ')' : '}';
+    ps->pos++;
+
+    cmd->group = parse_list_until(ps, closer);
+    if (!cmd->group)
+      return -1;
+    if (!peek(ps)) {
+      print_error(closer == ')' ? "syntax error: missing )"
+                                : "syntax error: missing }");
+      return -1;
     }
+    ps->pos++;
+
+    /* Job listings and traces show the group by its brackets */
+    cmd->subshell = (closer == ')');
+    cmd->argv = arena_alloc(ps->arena, 2 * sizeof(char *));
+    if (!cmd->argv)
+      return -1;
+    cmd->argv[0] = cmd->subshell ? "( ... )" : "{ ... }";
+    cmd->argv[1] = NULL;
+    cmd->argc = 1;
+  }
+
+  for (end = ps->pos; end < ps->count; end++) {
+    if (ends_command(ps->tokens[end].kind))
+      break;
+  }
+
+  return parse_words(ps, end, cmd, cmd->group == NULL);
+}
+
+/* Parse one pipeline: [time [-p]] command | command ... */
+static Pipeline *parse_pipeline(Parser *ps) {
+  Pipeline *pipeline = arena_alloc(ps->arena, sizeof(Pipeline));
+  if (!pipeline) {
+    return NULL;
+  }
+  pipeline->commands = NULL;
+  pipeline->cmd_count = 0;
+  pipeline->timed = 0;
+  pipeline->time_posix = 0;
+
+  /* time [-p] keyword; a quoted 'time' has a longer raw slice */
+  Token *tok = peek(ps);
+  if (tok && is_keyword(tok, "time")) {
+    pipeline->timed = 1;
+    ps->pos++;
+    tok = peek(ps);
+    if (tok && tok->kind == TOK_WORD && strcmp(tok->text, "-p") == 0) {
+      pipeline->time_posix = 1;
+      ps->pos++;
+    }
+  }
+
+  int cap = 0;
+  while (1) {
+    pipeline->commands = grow_array(ps->arena, pipeline->commands,
+                                    pipeline->cmd_count, &cap,
+                                    sizeof(Command));
+    if (!pipeline->commands)
+      return NULL;
+
+    if (parse_command(ps, &pipeline->commands[pipeline->cmd_count]) < 0)
+      return NULL;
+    pipeline->cmd_count++;
+
+    tok = peek(ps);
+    if (!tok || tok->kind != TOK_PIPE)
+      break;
+    ps->pos++;
   }
 
   return pipeline;
 }
 
-void free_pipeline(Pipeline *pipeline) {
-  if (!pipeline)
-    return;
+/* Label for jobs and traces: each pipeline's commands and the operators */
+static char *list_label(ListItem *items, int count, Arena *arena) {
+  size_t len = 1;
 
-  for (int i = 0; i < pipeline->cmd_count; i++) {
-    Command *cmd = &pipeline->commands[i];
+  for (int i = 0; i < count; i++) {
+    Pipeline *p = items[i].pipeline;
+    for (int j = 0; j < p->cmd_count; j++)
+      len += strlen(p->commands[j].argv[0]) + 4;
+  }
 
-    /* Free argv */
-    if (cmd->argv) {
-      for (int j = 0; j < cmd->argc; j++) {
-        if (cmd->argv[j]) {
-          free(cmd->argv[j]);
-        }
-      }
-      free(cmd->argv);
+  char *label = arena_alloc(arena, len);
+  if (!label)
+    return NULL;
+
+  label[0] = '\0';
+  for (int i = 0; i < count; i++) {
+    Pipeline *p = items[i].pipeline;
+    if (i > 0)
+      strcat(label, items[i].op == LIST_AND ? " && " : " || ");
+    for (int j = 0; j < p->cmd_count; j++) {
+      if (j > 0)
+        strcat(label, " | ");
+      strcat(label, p->commands[j].argv[0]);
     }
+  }
+  return label;
+}
 
-    /* Free redirections */
-    if (cmd->redirs) {
-      for (int j = 0; j < cmd->redir_count; j++) {
-        if (cmd->redirs[j].filename) {
-          free(cmd->redirs[j].filename);
-        }
-      }
-      free(cmd->redirs);
+/*
+ * Turn the AND-OR list that ends with & (items from first on) into one
+ * background subshell, as if it were written ( a && b ) &, so the whole
+ * list runs alongside the shell and not only its last pipeline.
+ */
+static int background_and_or(CommandList *cl, int first, Arena *arena) {
+  CommandList *inner = arena_alloc(arena, sizeof(CommandList));
+  Pipeline *pipeline = arena_alloc(arena, sizeof(Pipeline));
+  Command *cmd = arena_alloc(arena, sizeof(Command));
+  char **argv = arena_alloc(arena, 2 * sizeof(char *));
+  if (!inner || !pipeline || !cmd || !argv)
+    return -1;
+
+  inner->count = cl->count - first;
+  inner->items = arena_alloc(arena, inner->count * sizeof(ListItem));
+  if (!inner->items)
+    return -1;
+  memcpy(inner->items, cl->items + first, inner->count * sizeof(ListItem));
+  inner->items[0].op = LIST_SEQ;
+
+  argv[0] = list_label(inner->items, inner->count, arena);
+  argv[1] = NULL;
+  if (!argv[0])
+    return -1;
+
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->argv = argv;
+  cmd->argc = 1;
+  cmd->group = inner;
+  cmd->subshell = 1;
+  cmd->background = 1;
+
+  memset(pipeline, 0, sizeof(*pipeline));
+  pipeline->commands = cmd;
+  pipeline->cmd_count = 1;
+
+  cl->count = first;
+  cl->items[cl->count].pipeline = pipeline;
+  cl->items[cl->count].op = LIST_SEQ;
+  cl->count++;
+  return 0;
+}
+
+/*
+ * Parse pipelines separated by ;, &, && or || up to closer: ')' or '}'
+ * for a group, 0 for the end of the line. A trailing ; or & is allowed;
+ * a missing pipeline anywhere else is a syntax error.
+ */
+static CommandList *parse_list_until(Parser *ps, char closer) {
+  CommandList *cl = arena_alloc(ps->arena, sizeof(CommandList));
+  int cap = 0;
+  int and_or_start = 0; /* First item after the last ; or & */
+  ListOp op = LIST_SEQ;
+
+  if (!cl)
+    return NULL;
+  cl->items = NULL;
+  cl->count = 0;
+
+  while (1) {
+    Token *tok = peek(ps);
+
+    if (at_list_end(ps, closer) || is_list_separator(tok->kind) ||
+        tok->kind == TOK_RPAREN) {
+      /* Nothing after a final ; or & */
+      if (at_list_end(ps, closer) && cl->count > 0 && op == LIST_SEQ)
+        break;
+      print_error(tok ? "syntax error: missing command"
+                      : "syntax error: missing command at end");
+      return NULL;
+    }
+    if (closer != '}' && is_keyword(tok, "}")) {
+      print_error("syntax error: unexpected }");
+      return NULL;
+    }
+
+    Pipeline *pipeline = parse_pipeline(ps);
+    if (!pipeline)
+      return NULL;
+
+    cl->items = grow_array(ps->arena, cl->items, cl->count, &cap,
+                           sizeof(ListItem));
+    if (!cl->items)
+      return NULL;
+    cl->items[cl->count].pipeline = pipeline;
+    cl->items[cl->count].op = op;
+    cl->count++;
+
+    if (at_list_end(ps, closer))
+      break;
+
+    tok = peek(ps);
+    if (!is_list_separator(tok->kind)) {
+      print_error(tok->kind == TOK_RPAREN ? "syntax error: unexpected )"
+                                          : "syntax error: unexpected (");
+      return NULL;
+    }
+
+    /*
+     * & applies to the whole AND-OR list before it: a lone pipeline runs
+     * in the background as it is, a && or || chain as one subshell
+     */
+    if (tok->kind == TOK_AMP && cl->count - and_or_start > 1) {
+      if (background_and_or(cl, and_or_start, ps->arena) < 0)
+        return NULL;
+    } else if (tok->kind == TOK_AMP) {
+      for (int i = 0; i < pipeline->cmd_count; i++)
+        pipeline->commands[i].background = 1;
     }
+    if (tok->kind == TOK_AMP || tok->kind == TOK_SEMI)
+      and_or_start = cl->count;
+
+    op = tok->kind == TOK_AND_IF  ? LIST_AND
+         : tok->kind == TOK_OR_IF ? LIST_OR
+                                  : LIST_SEQ;
+    ps->pos++;
   }
 
-  free(pipeline->commands);
-  free(pipeline);
+  return cl;
+}
+
+/*
+ * Parse a line into a command list. All structures are allocated from
+ * the line's arena.
+ */
+CommandList *parse_list(TokenList *list, Arena *arena) {
+  Parser ps = {list->tokens, list->count, 0, arena};
+
+  if (list->count == 0)
+    return NULL;
+
+  return parse_list_until(&ps, 0);
 }
@@ -1,20 +1,270 @@
+#define _GNU_SOURCE
 #include "shell.h"
 
+/* Build the command string shown by jobs (caller frees) */
+static char *pipeline_string(Pipeline *pipeline, int background) {
+  size_t len = 3;
+  int i;
+
+  for (i = 0; i < pipeline->cmd_count; i++) {
+    len += strlen(pipeline->commands[i].argv[0]) + 3;
+  }
+
+  char *cmd_str = malloc(len);
+  if (!cmd_str) {
+    perror("malloc");
+    return NULL;
+  }
+
+  cmd_str[0] = '\0';
+  for (i = 0; i < pipeline->cmd_count; i++) {
+    if (i > 0)
+      strcat(cmd_str, " | ");
+    strcat(cmd_str, pipeline->commands[i].argv[0]);
+  }
+  if (background)
+    strcat(cmd_str, " &");
+
+  return cmd_str;
+}
+
+/*
+ * Wait for a foreground job. A stopped job stays in the table and is
+ * reported; the caller removes a finished one. Returns the job's status.
+ */
+static int wait_foreground_job(Job *job, Pipeline *pipeline, Command *cmd,
+                               int *stopped) {
+  int status = wait_for_job(job);
+
+  *stopped = (job->state == JOB_STOPPED);
+  if (*stopped) {
+    job->command = pipeline ? pipeline_string(pipeline, 0)
+                            : strdup(cmd->argv[0]);
+    printf("\n[%d]+ Stopped %s\n", job->job_id,
+           job->command ? job->command : "");
+  }
+
+  return status;
+}
+
+/*
+ * Report a finished timed pipeline. Child stages are taken from the job's
+ * processes in pipeline order; the in-shell stage, if any, from inproc.
+ */
+static void report_times(Pipeline *pipeline, Job *job, int inproc_idx,
+                         const StageTime *inproc, const TimeMark *start) {
+  StageTime *stages =
+      arena_alloc(&g_shell.arena, pipeline->cmd_count * sizeof(StageTime));
+  int count = 0;
+  int k = 0;
+  int i;
+
+  if (!stages)
+    return;
+
+  for (i = 0; i < pipeline->cmd_count; i++) {
+    const char *name = pipeline->commands[i].argv[0];
+    if (i == inproc_idx) {
+      stages[count++] = *inproc;
+    } else if (k < job->proc_count) {
+      time_stage_child(&stages[count++], name, &job->procs[k++], start);
+    }
+  }
+
+  time_report(stages, count, time_elapsed(start), pipeline->time_posix);
+}
+
+/* A builtin, or the list of a brace group */
+static int run_here_body(Command *cmd) {
+  return cmd->group ? execute_list(cmd->group) : execute_builtin(cmd);
+}
+
+/*
+ * Run a builtin or brace group in the shell process with its
+ * redirections applied once. The descriptors they replace are saved
+ * above 10 and put back afterwards.
+ */
+static int run_builtin_here(Command *cmd) {
+  int saved_fds[3] = {-1, -1, -1};
+  int status;
+
+  if (cmd->redir_count == 0)
+    return run_here_body(cmd);
+
+  fflush(stdout);
+  fflush(stderr);
+  if (setup_redirections(cmd->redirs, cmd->redir_count, saved_fds) < 0) {
+    restore_redirections(saved_fds, 3);
+    return 1;
+  }
+
+  status = run_here_body(cmd);
+  fflush(stdout);
+  fflush(stderr);
+  restore_redirections(saved_fds, 3);
+  return status;
+}
+
+/*
+ * Whether builtin b may run inside the shell. An interactive shell
+ * ignores SIGINT and hands the terminal to the job's process group, so a
+ * builtin that reads stdin or waits on its own children (cat | grep,
+ * cat /dev/zero, parallel) needs a process in that group for the
+ * terminal and Ctrl-C to reach it.
+ */
+static int runs_in_shell(const Builtin *b) {
+  return !(g_shell.is_interactive && (b->flags & BUILTIN_BLOCKING));
+}
+
+/*
+ * Run a builtin pipeline stage inside the shell with stdin/stdout pointed
+ * at its pipe ends. The shell's own descriptors are parked above 10 with
+ * close-on-exec and put back afterwards.
+ */
+static int run_builtin_stage(Command *cmd, int in_fd, int out_fd) {
+  int saved_in = -1;
+  int saved_out = -1;
+  int status;
+  void (*old_sigpipe)(int);
+
+  fflush(stdout);
+
+  if (in_fd >= 0) {
+    saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(in_fd, STDIN_FILENO);
+    close(in_fd);
+  }
+  if (out_fd >= 0) {
+    saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(out_fd, STDOUT_FILENO);
+    close(out_fd);
+  }
+
+  /* A reader that exits early must not kill the shell */
+  old_sigpipe = signal(SIGPIPE, SIG_IGN);
+  uint64_t t = trace_begin();
+  status = run_builtin_here(cmd);
+  trace_end("builtin", t, cmd->argv[0]);
+  fflush(stdout);
+  clearerr(stdout);
+  signal(SIGPIPE, old_sigpipe);
+
+  /* Restoring closes the pipe ends, so neighbours see EOF */
+  if (in_fd >= 0) {
+    if (saved_in >= 0) {
+      dup2(saved_in, STDIN_FILENO);
+      close(saved_in);
+    } else {
+      close(STDIN_FILENO);
+    }
+  }
+  if (out_fd >= 0) {
+    if (saved_out >= 0) {
+      dup2(saved_out, STDOUT_FILENO);
+      close(saved_out);
+    } else {
+      close(STDOUT_FILENO);
+    }
+  }
+
+  return status < 0 ? 1 : status;
+}
+
+/* Largest pipe an unprivileged process may ask for */
+static long pipe_max_size(void) {
+  FILE *f = fopen("/proc/sys/fs/pipe-max-size", "re");
+  long max = 1024 * 1024;
+
+  if (f) {
+    if (fscanf(f, "%ld", &max) != 1)
+      max = 1024 * 1024;
+    fclose(f);
+  }
+  return max;
+}
+
+/*
+ * Set the capacity of the pipes between stages (set -o pipesize=N,
+ * SEAL_PIPESIZE=N). N may end in k or m; NULL asks for the system
+ * maximum, and larger sizes are cut down to it. Returns -1 if arg is
+ * not a size.
+ */
+int set_pipe_size(const char *arg) {
+  long max = pipe_max_size();
+  long size = max;
+
+  if (arg) {
+    char *end;
+    size = strtol(arg, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+      size *= 1024;
+      end++;
+    } else if (*end == 'm' || *end == 'M') {
+      size *= 1024 * 1024;
+      end++;
+    }
+    if (end == arg || *end != '\0' || size <= 0)
+      return -1;
+  }
+
+  g_shell.pipe_size = size > max ? max : size;
+  return 0;
+}
+
 int execute_pipeline(Pipeline *pipeline) {
   if (!pipeline || pipeline->cmd_count == 0)
     return -1;
 
+  /* Only the subshell's own list may exec in place, not nested ones */
+  int exec_tail = g_shell.exec_tail;
+  g_shell.exec_tail = 0;
+
+  TimeMark start;
+  if (pipeline->timed) {
+    time_mark(&start);
+  }
+
   /* Single command (no pipe) */
   if (pipeline->cmd_count == 1) {
     Command *cmd = &pipeline->commands[0];
 
-    /* Check if built-in */
-    if (is_builtin(cmd->argv[0])) {
-      return execute_builtin(cmd);
+    /* NAME=value words on their own set shell variables */
+    if (!cmd->group && is_assignment(cmd->argv[0])) {
+      int i = 1;
+      while (cmd->argv[i] && is_assignment(cmd->argv[i]))
+        i++;
+      if (!cmd->argv[i])
+        return assign_variables(cmd->argv);
+    }
+
+    /*
+     * Check if built-in; a utility builtin with &, or one that has to
+     * run under job control, runs in a child. A brace group runs in the
+     * shell too, unless it has &.
+     */
+    const Builtin *b = cmd->group ? NULL : lookup_builtin(cmd->argv);
+    int here = cmd->group ? !cmd->subshell && !cmd->background
+                          : b && ((b->flags & BUILTIN_STATEFUL) ||
+                                  (!cmd->background && runs_in_shell(b)));
+    if (here) {
+      if (!pipeline->timed)
+        return run_builtin_here(cmd);
+
+      StageTime st;
+      int status = run_builtin_here(cmd);
+      time_stage_self(&st, cmd->argv[0], &start);
+      time_report(&st, 1, st.real, pipeline->time_posix);
+      return status;
     }
 
-    /* Execute external command */
-    return execute_command(cmd, 0, -1, -1);
+    /* The last command of a subshell needs no fork of its own */
+    if (exec_tail && !b && !cmd->group && !cmd->background &&
+        !pipeline->timed)
+      exec_in_place(cmd);
+
+    /* Execute external command; a timed one takes the general path */
+    if (!b && !pipeline->timed)
+      return execute_command(cmd, 0, -1, -1);
   }
 
   /* Pipeline with multiple commands */
@@ -22,84 +272,79 @@ int execute_pipeline(Pipeline *pipeline) {
   int pipefds[2];
   int prev_pipe = -1;
   pid_t pgid = 0;
-  pid_t pid;
+  pid_t pid = -1;
   int background = pipeline->commands[0].background;
 
+  /* Member pids in pipeline order, for the job table */
+  pid_t *pids = arena_alloc(&g_shell.arena,
+                            pipeline->cmd_count * sizeof(pid_t));
+  int pid_count = 0;
+  if (!pids)
+    return -1;
+
+  /* A background job takes a jobserver slot before it starts */
+  int token = background ? jobserver_acquire() : JOB_TOKEN_NONE;
+  if (token == JOB_TOKEN_INTERRUPTED)
+    return WAIT_INTERRUPTED;
+
+  /*
+   * One builtin stage of a foreground pipeline runs inside the shell
+   * instead of in a child. It runs after every other stage has started,
+   * so the processes on both sides of it are already there to drain or
+   * fill its pipes. Further builtin stages are forked.
+   */
+  int inproc = -1;
+  int inproc_in = -1;
+  int inproc_out = -1;
+  if (!background) {
+    for (i = 0; i < pipeline->cmd_count; i++) {
+      Command *cmd = &pipeline->commands[i];
+      const Builtin *b = lookup_builtin(cmd->argv);
+      if (b && !(b->flags & BUILTIN_STATEFUL) && runs_in_shell(b)) {
+        inproc = i;
+        break;
+      }
+    }
+  }
+
   for (i = 0; i < pipeline->cmd_count; i++) {
     Command *cmd = &pipeline->commands[i];
 
-    /* Create pipe for all but last command */
+    /*
+     * Create pipe for all but last command. Both ends are close-on-exec:
+     * children only keep what is dup2'd onto their stdin/stdout, so the
+     * ends held for the in-shell stage never leak into other stages.
+     */
     int next_pipe = -1;
+    int write_end = -1;
     if (i < pipeline->cmd_count - 1) {
-      if (pipe(pipefds) < 0) {
+      if (pipe2(pipefds, O_CLOEXEC) < 0) {
         perror("pipe");
-        return -1;
+        if (prev_pipe >= 0)
+          close(prev_pipe);
+        break;
       }
       next_pipe = pipefds[0];
-    }
+      write_end = pipefds[1];
 
-    /* Fork child */
-    pid = fork();
-    if (pid < 0) {
-      perror("fork");
-      if (next_pipe >= 0) {
-        close(pipefds[0]);
-        close(pipefds[1]);
-      }
-      return -1;
+      /* Best effort: the kernel may refuse past the user's pipe quota */
+      if (g_shell.pipe_size > 0)
+        fcntl(write_end, F_SETPIPE_SZ, g_shell.pipe_size);
     }
 
-    if (pid == 0) {
-      /* Child process */
-
-      /* Set process group (first command creates group) */
-      if (pgid == 0) {
-        pgid = getpid();
-      }
-      setpgid(0, pgid);
-
-      /* If not background and interactive, give terminal to process group */
-      if (!background && g_shell.is_interactive) {
-        tcsetpgrp(g_shell.shell_terminal, pgid);
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-      }
-
-      /* Setup redirections */
-      int saved_fds[3] = {-1, -1, -1};
-      if (setup_redirections(cmd->redirs, cmd->redir_count, saved_fds) < 0) {
-        exit(1);
-      }
-
-      /* Setup pipe input */
-      if (prev_pipe >= 0) {
-        dup2(prev_pipe, STDIN_FILENO);
-        close(prev_pipe);
-      }
-
-      /* Setup pipe output */
-      if (next_pipe >= 0) {
-        dup2(pipefds[1], STDOUT_FILENO);
-        close(pipefds[0]);
-        close(pipefds[1]);
-      }
-
-      /* Execute command */
-      execvp(cmd->argv[0], cmd->argv);
-      perror(cmd->argv[0]);
-      exit(127);
+    /* Keep the in-shell stage's pipe ends until the others are running */
+    if (i == inproc) {
+      inproc_in = prev_pipe;
+      inproc_out = write_end;
+      g_shell.held_fds[0] = inproc_in;
+      g_shell.held_fds[1] = inproc_out;
+      prev_pipe = next_pipe;
+      continue;
     }
 
-    /* Parent process */
-
-    /* Set process group for first command */
-    if (pgid == 0) {
-      pgid = pid;
-    }
-    setpgid(pid, pgid);
+    /* Launch child (first command creates the process group) */
+    pid = launch_process(cmd, pgid, prev_pipe, write_end, next_pipe,
+                         !background);
 
     /* Close previous pipe */
     if (prev_pipe >= 0) {
@@ -107,132 +352,210 @@ int execute_pipeline(Pipeline *pipeline) {
     }
 
     /* Close write end of current pipe */
-    if (next_pipe >= 0) {
-      close(pipefds[1]);
+    if (write_end >= 0) {
+      close(write_end);
+    }
+
+    if (pid < 0) {
+      if (next_pipe >= 0)
+        close(next_pipe);
+      break;
+    }
+
+    if (pgid == 0) {
+      pgid = pid;
     }
+    pids[pid_count++] = pid;
 
     prev_pipe = next_pipe;
   }
 
+  g_shell.held_fds[0] = g_shell.held_fds[1] = -1;
+
+  /* A stage failed to start: tear down the in-shell stage's pipes too */
+  if (i < pipeline->cmd_count) {
+    if (inproc_in >= 0)
+      close(inproc_in);
+    if (inproc_out >= 0)
+      close(inproc_out);
+    inproc = -1;
+  }
+
+  /*
+   * Register the stages that are running before the builtin stage runs:
+   * one that reaps children (parallel) then records their statuses in
+   * the job instead of dropping them. It stays unlisted meanwhile.
+   */
+  Job *job = NULL;
+  if (!background && pgid != 0) {
+    job = add_job(pgid, pids, pid_count, NULL, JOB_RUNNING);
+    if (job)
+      job->quiet = 1;
+  }
+
+  /* Run the builtin stage now that its neighbours exist */
+  int inproc_status = 0;
+  StageTime inproc_time;
+  if (inproc >= 0) {
+    TimeMark mark;
+    if (pipeline->timed)
+      time_mark(&mark);
+    inproc_status = run_builtin_stage(&pipeline->commands[inproc], inproc_in,
+                                      inproc_out);
+    if (pipeline->timed)
+      time_stage_self(&inproc_time, pipeline->commands[inproc].argv[0],
+                      &mark);
+  }
+
+  /* Nothing was started */
+  if (pgid == 0) {
+    jobserver_release(token);
+    return inproc >= 0 ? inproc_status : -1;
+  }
+
   /* Add job if background */
   if (background) {
-    /* Build command string */
-    char cmd_str[MAX_LINE] = "";
-    for (i = 0; i < pipeline->cmd_count; i++) {
-      if (i > 0)
-        strcat(cmd_str, " | ");
-      strcat(cmd_str, pipeline->commands[i].argv[0]);
+    char *cmd_str = pipeline_string(pipeline, 1);
+    Job *job = add_job(pgid, pids, pid_count, cmd_str, JOB_RUNNING);
+    if (job) {
+      job->token = token;
+      printf("[%d] %d\n", job->job_id, pgid);
+    } else {
+      jobserver_release(token);
     }
-    strcat(cmd_str, " &");
+    free(cmd_str);
+    return 0;
+  }
 
-    add_job(pgid, cmd_str, JOB_RUNNING);
-    printf("[%d] %d\n", g_shell.job_count, pgid);
-  } else {
-    /* Wait for foreground pipeline */
-    int status;
-    pid_t wait_pid;
-
-    while (1) {
-      wait_pid = waitpid(-pgid, &status, WUNTRACED);
-
-      if (wait_pid < 0) {
-        if (errno == ECHILD) {
-          /* All children finished */
-          break;
-        }
-        if (errno == EINTR) {
-          /* Interrupted by signal, continue */
-          continue;
-        }
-        perror("waitpid");
-        break;
-      }
+  /* Wait for foreground pipeline */
+  if (!job)
+    return -1;
+  job->quiet = 0;
+  int stopped;
+  int status = wait_foreground_job(job, pipeline, NULL, &stopped);
+  if (!stopped) {
+    if (pipeline->timed)
+      report_times(pipeline, job, inproc, &inproc_time, &start);
+    remove_job(job->job_id);
+  }
 
-      /* Check if stopped */
-      if (WIFSTOPPED(status)) {
-        /* Build command string */
-        char cmd_str[MAX_LINE] = "";
-        for (i = 0; i < pipeline->cmd_count; i++) {
-          if (i > 0)
-            strcat(cmd_str, " | ");
-          strcat(cmd_str, pipeline->commands[i].argv[0]);
-        }
-
-        add_job(pgid, cmd_str, JOB_STOPPED);
-        printf("\n[%d]+ Stopped %s\n", g_shell.job_count, cmd_str);
-        break;
-      }
+  /* The pipeline's status is the last stage's, wherever it ran */
+  if (inproc == pipeline->cmd_count - 1 && !stopped) {
+    status = inproc_status;
+  }
 
-      /* Check if all processes in group are done */
-      if (WIFEXITED(status) || WIFSIGNALED(status)) {
-        /* Check if there are more processes */
-        if (waitpid(-pgid, &status, WNOHANG) == 0) {
-          continue;
-        }
-      }
-    }
+  return status;
+}
 
-    /* Give terminal back to shell */
-    if (g_shell.is_interactive) {
-      tcsetpgrp(g_shell.shell_terminal, g_shell.shell_pgid);
-    }
+/*
+ * Run one pipeline of a list: expand its words, then open its
+ * here-documents and substitutions around it
+ */
+static int run_list_item(Pipeline *pipeline) {
+  int status;
+
+  if (expand_pipeline(pipeline, &g_shell.arena) < 0)
+    return 1;
+  if (open_here_docs(pipeline) < 0)
+    return 1;
+  if (open_proc_subs(pipeline, &g_shell.arena) < 0) {
+    close_here_docs(pipeline);
+    return 1;
   }
 
-  return 0;
+  uint64_t t = trace_begin();
+  status = execute_pipeline(pipeline);
+  trace_end("execute_pipeline", t, pipeline->commands[0].argv[0]);
+
+  close_proc_subs(pipeline);
+  close_here_docs(pipeline);
+
+  /* Builtins report failure as -1 */
+  return status < 0 ? 1 : status;
+}
+
+/*
+ * Run a command list left to right. && and || test the status of the
+ * last pipeline that ran, so "a && b || c" runs c when a or b fails.
+ */
+int execute_list(CommandList *list) {
+  /* In a subshell, only the list's last pipeline may exec in place */
+  int exec_tail = g_shell.exec_tail;
+
+  for (int i = 0; i < list->count; i++) {
+    ListItem *item = &list->items[i];
+
+    if (item->op == LIST_AND && g_shell.last_status != 0)
+      continue;
+    if (item->op == LIST_OR && g_shell.last_status == 0)
+      continue;
+
+    g_shell.exec_tail = exec_tail && i == list->count - 1;
+    g_shell.last_status = run_list_item(item->pipeline);
+  }
+  g_shell.exec_tail = 0;
+
+  return g_shell.last_status;
 }
 
 int execute_command(Command *cmd, int is_pipe, int in_fd, int out_fd) {
   pid_t pid;
-  int status;
 
   /* Check if built-in */
-  if (!is_pipe && is_builtin(cmd->argv[0])) {
+  if (!is_pipe && lookup_builtin(cmd->argv)) {
     return execute_builtin(cmd);
   }
 
-  /* Fork child */
-  pid = fork();
+  /* A background job takes a jobserver slot before it starts */
+  int token = cmd->background ? jobserver_acquire() : JOB_TOKEN_NONE;
+  if (token == JOB_TOKEN_INTERRUPTED)
+    return WAIT_INTERRUPTED;
+
+  /* Launch child in its own process group */
+  pid = launch_process(cmd, 0, in_fd, out_fd, -1, !cmd->background);
   if (pid < 0) {
-    perror("fork");
+    jobserver_release(token);
     return -1;
   }
 
-  if (pid == 0) {
-    /* Child process */
-
-    /* Restore default signal handlers */
-    if (g_shell.is_interactive) {
-      signal(SIGINT, SIG_DFL);
-      signal(SIGQUIT, SIG_DFL);
-      signal(SIGTSTP, SIG_DFL);
-      signal(SIGTTIN, SIG_DFL);
-      signal(SIGTTOU, SIG_DFL);
+  /* Parent process */
+  if (cmd->background) {
+    Job *job = add_job(pid, &pid, 1, cmd->argv[0], JOB_RUNNING);
+    if (job) {
+      job->token = token;
+      printf("[%d] %d\n", job->job_id, pid);
+    } else {
+      jobserver_release(token);
     }
+    return 0;
+  }
 
-    /* Setup redirections */
-    int saved_fds[3] = {-1, -1, -1};
-    if (setup_redirections(cmd->redirs, cmd->redir_count, saved_fds) < 0) {
-      exit(1);
-    }
+  /* Wait for foreground process */
+  Job *job = add_job(pid, &pid, 1, NULL, JOB_RUNNING);
+  if (!job)
+    return -1;
+  int stopped;
+  int status = wait_foreground_job(job, NULL, cmd, &stopped);
+  if (!stopped)
+    remove_job(job->job_id);
+  return status;
+}
 
-    /* Execute command */
-    execvp(cmd->argv[0], cmd->argv);
-    perror(cmd->argv[0]);
-    exit(127);
+void exec_external(Command *cmd, const char *path) {
+  if (path == NULL) {
+    fprintf(stderr, "seal: %s: command not found\n", cmd->argv[0]);
+    _exit(127);
   }
 
-  /* Parent process */
-  if (!cmd->background) {
-    /* Wait for foreground process */
-    waitpid(pid, &status, 0);
+  execve(path, cmd->argv, var_environ());
 
-    if (WIFEXITED(status)) {
-      return WEXITSTATUS(status);
-    }
-  } else {
-    printf("[%d] %d\n", g_shell.job_count + 1, pid);
-    add_job(pid, cmd->argv[0], JOB_RUNNING);
+  /* A hashed path may be stale, and scripts without #! need /bin/sh */
+  if (errno == ENOENT && path != cmd->argv[0]) {
+    execvp(cmd->argv[0], cmd->argv);
+  } else if (errno == ENOEXEC) {
+    execvp(path, cmd->argv);
   }
 
-  return 0;
+  perror(cmd->argv[0]);
+  _exit(127);
 }
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+/*
+ * Process substitution: <(cmd) and >(cmd).
+ *
+ * Just before the pipeline runs, each inner command line is started in a
+ * forked copy of the shell on one end of a pipe, and the argument becomes
+ * /dev/fd/N for the shell's end. That end is close-on-exec like every
+ * other descriptor the shell holds; the launcher clears the flag only in
+ * the process of the command that names it, so other stages and other
+ * substitutions never keep a pipe open. Once the pipeline has started the
+ * shell closes its ends.
+ *
+ * The inner commands are quiet jobs: reap_children() collects them like
+ * any background job, but they are not listed or announced.
+ */
+
+static int start_proc_sub(ProcSub *ps, char **argv, Arena *arena) {
+  int p[2];
+  pid_t pid;
+  char path[32];
+
+  if (pipe2(p, O_CLOEXEC) < 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  /* <(cmd) writes into the pipe, >(cmd) reads from it */
+  if (ps->output) {
+    pid = fork_line(ps->command, 0, p[0], -1, p[1]);
+    close(p[0]);
+    ps->fd = p[1];
+  } else {
+    pid = fork_line(ps->command, 0, -1, p[1], p[0]);
+    close(p[1]);
+    ps->fd = p[0];
+  }
+
+  if (pid < 0) {
+    close(ps->fd);
+    ps->fd = -1;
+    return -1;
+  }
+
+  Job *job = add_job(pid, &pid, 1, ps->command, JOB_RUNNING);
+  if (job)
+    job->quiet = 1;
+
+  snprintf(path, sizeof(path), "/dev/fd/%d", ps->fd);
+  argv[ps->arg] = arena_strdup(arena, path);
+  return argv[ps->arg] ? 0 : -1;
+}
+
+/* Start every process substitution in the pipeline */
+int open_proc_subs(Pipeline *pipeline, Arena *arena) {
+  for (int i = 0; i < pipeline->cmd_count; i++) {
+    Command *cmd = &pipeline->commands[i];
+
+    for (int j = 0; j < cmd->procsub_count; j++) {
+      if (start_proc_sub(&cmd->procsubs[j], cmd->argv, arena) < 0) {
+        close_proc_subs(pipeline);
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/* Drop the shell's pipe ends; the command's own copies keep them open */
+void close_proc_subs(Pipeline *pipeline) {
+  for (int i = 0; i < pipeline->cmd_count; i++) {
+    Command *cmd = &pipeline->commands[i];
+
+    for (int j = 0; j < cmd->procsub_count; j++) {
+      if (cmd->procsubs[j].fd >= 0) {
+        close(cmd->procsubs[j].fd);
+        cmd->procsubs[j].fd = -1;
+      }
+    }
+  }
+}
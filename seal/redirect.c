@@ -1,123 +1,118 @@
 #include "shell.h"
 
+/* Marks a saved slot whose descriptor was closed before the redirection */
+#define FD_WAS_CLOSED (-2)
+
+/*
+ * Remember what target pointed at before its first redirection. The copy
+ * goes above 10 with close-on-exec, out of the way of the command's own
+ * descriptors and of anything the builtin starts.
+ */
+static void save_fd(int *saved_fds, int target) {
+  if (!saved_fds || saved_fds[target] != -1)
+    return;
+
+  saved_fds[target] = fcntl(target, F_DUPFD_CLOEXEC, 10);
+  if (saved_fds[target] < 0 && errno == EBADF)
+    saved_fds[target] = FD_WAS_CLOSED;
+}
+
+/* Open filename and put it on target */
+static int redirect_file(const char *filename, int flags, int target) {
+  int fd = open(filename, flags, 0644);
+  if (fd < 0) {
+    perror(filename);
+    return -1;
+  }
+  if (fd != target) {
+    if (dup2(fd, target) < 0) {
+      perror("dup2");
+      close(fd);
+      return -1;
+    }
+    close(fd);
+  }
+  return 0;
+}
+
+/*
+ * Apply a command's redirections to the current process. With saved_fds
+ * (three slots, initialised to -1) the original stdin/stdout/stderr are
+ * kept for restore_redirections(), so builtins can redirect inside the
+ * shell; a child about to exec passes NULL.
+ */
 int setup_redirections(Redirection *redirs, int count, int *saved_fds) {
   if (!redirs || count == 0)
     return 0;
 
   for (int i = 0; i < count; i++) {
     Redirection *r = &redirs[i];
-    int fd = -1;
+    int result = 0;
 
     switch (r->type) {
     case REDIR_IN:
-      /* Save stdin */
-      saved_fds[0] = dup(STDIN_FILENO);
-      /* Open file for reading */
-      fd = open(r->filename, O_RDONLY);
-      if (fd < 0) {
-        perror(r->filename);
-        return -1;
-      }
-      /* Redirect stdin */
-      if (dup2(fd, STDIN_FILENO) < 0) {
-        perror("dup2");
-        close(fd);
-        return -1;
-      }
-      close(fd);
+      save_fd(saved_fds, STDIN_FILENO);
+      result = redirect_file(r->filename, O_RDONLY, STDIN_FILENO);
       break;
 
     case REDIR_OUT:
-      /* Save stdout */
-      saved_fds[1] = dup(STDOUT_FILENO);
-      /* Open file for writing (truncate) */
-      fd = open(r->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-      if (fd < 0) {
-        perror(r->filename);
-        return -1;
-      }
-      /* Redirect stdout */
-      if (dup2(fd, STDOUT_FILENO) < 0) {
-        perror("dup2");
-        close(fd);
-        return -1;
-      }
-      close(fd);
+      save_fd(saved_fds, STDOUT_FILENO);
+      result = redirect_file(r->filename, O_WRONLY | O_CREAT | O_TRUNC,
+                             STDOUT_FILENO);
       break;
 
     case REDIR_APPEND:
-      /* Save stdout */
-      saved_fds[1] = dup(STDOUT_FILENO);
-      /* Open file for writing (append) */
-      fd = open(r->filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
-      if (fd < 0) {
-        perror(r->filename);
-        return -1;
-      }
-      /* Redirect stdout */
-      if (dup2(fd, STDOUT_FILENO) < 0) {
-        perror("dup2");
-        close(fd);
-        return -1;
-      }
-      close(fd);
+      save_fd(saved_fds, STDOUT_FILENO);
+      result = redirect_file(r->filename, O_WRONLY | O_CREAT | O_APPEND,
+                             STDOUT_FILENO);
       break;
 
     case REDIR_ERR:
-      /* Save stderr */
-      saved_fds[2] = dup(STDERR_FILENO);
-      /* Open file for writing (truncate) */
-      fd = open(r->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-      if (fd < 0) {
-        perror(r->filename);
-        return -1;
-      }
-      /* Redirect stderr */
-      if (dup2(fd, STDERR_FILENO) < 0) {
+      save_fd(saved_fds, STDERR_FILENO);
+      result = redirect_file(r->filename, O_WRONLY | O_CREAT | O_TRUNC,
+                             STDERR_FILENO);
+      break;
+
+    case REDIR_HEREDOC:
+    case REDIR_HEREDOC_STRIP:
+    case REDIR_HERESTRING:
+      /* Body opened by open_here_docs() */
+      save_fd(saved_fds, STDIN_FILENO);
+      if (dup2(r->fd, STDIN_FILENO) < 0) {
         perror("dup2");
-        close(fd);
-        return -1;
+        result = -1;
       }
-      close(fd);
       break;
 
     case REDIR_ERR_OUT:
-      /* Save stderr */
-      saved_fds[2] = dup(STDERR_FILENO);
       /* Redirect stderr to stdout */
+      save_fd(saved_fds, STDERR_FILENO);
       if (dup2(STDOUT_FILENO, STDERR_FILENO) < 0) {
         perror("dup2");
-        return -1;
+        result = -1;
       }
       break;
 
     default:
       break;
     }
+
+    if (result < 0)
+      return -1;
   }
 
   return 0;
 }
 
+/* Put back the descriptors setup_redirections() saved */
 void restore_redirections(int *saved_fds, int count) {
-  /* Restore stdin */
-  if (saved_fds[0] >= 0) {
-    dup2(saved_fds[0], STDIN_FILENO);
-    close(saved_fds[0]);
-    saved_fds[0] = -1;
-  }
-
-  /* Restore stdout */
-  if (saved_fds[1] >= 0) {
-    dup2(saved_fds[1], STDOUT_FILENO);
-    close(saved_fds[1]);
-    saved_fds[1] = -1;
-  }
-
-  /* Restore stderr */
-  if (saved_fds[2] >= 0) {
-    dup2(saved_fds[2], STDERR_FILENO);
-    close(saved_fds[2]);
-    saved_fds[2] = -1;
+  for (int fd = 0; fd < count && fd <= STDERR_FILENO; fd++) {
+    if (saved_fds[fd] == FD_WAS_CLOSED) {
+      close(fd);
+    } else if (saved_fds[fd] >= 0) {
+      dup2(saved_fds[fd], fd);
+      close(saved_fds[fd]);
+    }
+    saved_fds[fd] = -1;
   }
 }
@@ -4,112 +4,404 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_LINE 1024
-#define MAX_ARGS 64
-#define MAX_JOBS 64
-#define MAX_TOKENS 128
-
 /* Job states */
 typedef enum { JOB_RUNNING, JOB_STOPPED, JOB_DONE } JobState;
 
 /* Redirection types */
 typedef enum {
   REDIR_NONE,
-  REDIR_IN,     /* < */
-  REDIR_OUT,    /* > */
-  REDIR_APPEND, /* >> */
-  REDIR_ERR,    /* 2> */
-  REDIR_ERR_OUT /* 2>&1 */
+  REDIR_IN,            /* < */
+  REDIR_OUT,           /* > */
+  REDIR_APPEND,        /* >> */
+  REDIR_ERR,           /* 2> */
+  REDIR_ERR_OUT,       /* 2>&1 */
+  REDIR_HEREDOC,       /* << */
+  REDIR_HEREDOC_STRIP, /* <<- */
+  REDIR_HERESTRING     /* <<< */
 } RedirType;
 
+/* Token kinds */
+typedef enum {
+  TOK_WORD,          /* Command word or filename */
+  TOK_PIPE,          /* | */
+  TOK_AMP,           /* & */
+  TOK_SEMI,          /* ; */
+  TOK_AND_IF,        /* && */
+  TOK_OR_IF,         /* || */
+  TOK_REDIR_IN,      /* < */
+  TOK_REDIR_OUT,     /* > */
+  TOK_REDIR_APPEND,  /* >> */
+  TOK_REDIR_ERR,     /* 2> */
+  TOK_REDIR_ERR_OUT, /* 2>&1 */
+  TOK_HEREDOC,       /* << */
+  TOK_HEREDOC_STRIP, /* <<- */
+  TOK_HERESTRING,    /* <<< */
+  TOK_PROCSUB_IN,    /* <(cmd) */
+  TOK_PROCSUB_OUT,   /* >(cmd) */
+  TOK_LPAREN,        /* ( */
+  TOK_RPAREN         /* ) */
+} TokenKind;
+
+/* Token: a slice of the input line */
+typedef struct {
+  TokenKind kind; /* Token kind */
+  size_t off;     /* Offset of the raw text in the line */
+  size_t len;     /* Length of the raw text */
+  char *text;     /* Word text (in the line, or unescaped in the arena) */
+  int expand;     /* Text is raw, expanded at run time ($ or a pattern) */
+  int quoted;     /* Word had quotes or backslashes */
+} Token;
+
+/* Growable token vector */
+typedef struct {
+  Token *tokens; /* Token array (arena) */
+  int count;     /* Number of tokens */
+  int cap;       /* Allocated slots */
+} TokenList;
+
 /* Redirection structure */
 typedef struct {
   RedirType type;
-  char *filename;
-  int fd;
+  char *filename; /* File, here-document delimiter or here-string word */
+  int fd;         /* Open here-document body, -1 otherwise */
+  char *body;     /* Here-document or here-string text (arena) */
+  size_t body_len;
+  int expand;     /* filename is raw text, expanded at run time */
+  int expand_body; /* Here-document with an unquoted delimiter: expand $ */
 } Redirection;
 
+/* Process substitution <(cmd) or >(cmd) in a command's arguments */
+typedef struct {
+  int arg;       /* argv slot that becomes /dev/fd/N */
+  int output;    /* >(cmd): the command writes into it */
+  char *command; /* Inner command line */
+  int fd;        /* Shell's end of the pipe, -1 when not started */
+} ProcSub;
+
+typedef struct CommandList CommandList;
+
 /* Command structure */
 typedef struct {
   char **argv;         /* Command arguments */
   int argc;            /* Argument count */
   Redirection *redirs; /* Array of redirections */
   int redir_count;     /* Number of redirections */
+  ProcSub *procsubs;   /* Process substitutions among the arguments */
+  int procsub_count;   /* Number of process substitutions */
+  char *expand;        /* expand[i]: argv[i] is raw text (NULL: none are) */
   int background;      /* Background flag */
+  CommandList *group;  /* ( list ) or { list; }: the commands inside */
+  int subshell;        /* group is a ( ) subshell */
 } Command;
 
 /* Pipeline structure */
 typedef struct {
   Command *commands; /* Array of commands */
   int cmd_count;     /* Number of commands in pipeline */
+  int timed;         /* Prefixed with time */
+  int time_posix;    /* time -p: POSIX output format */
 } Pipeline;
 
+/* How a list item is joined to the one before it */
+typedef enum {
+  LIST_SEQ, /* ; or & (or first): always runs */
+  LIST_AND, /* &&: runs if the previous status was 0 */
+  LIST_OR   /* ||: runs if the previous status was not 0 */
+} ListOp;
+
+/* One pipeline of a command list */
+typedef struct {
+  Pipeline *pipeline;
+  ListOp op;
+} ListItem;
+
+/* Command list: pipelines joined by ;, &, && and || */
+struct CommandList {
+  ListItem *items; /* Pipelines in order */
+  int count;       /* Number of pipelines */
+};
+
+/* One process of a job */
+typedef struct {
+  pid_t pid;                /* Process ID */
+  int status;               /* Last status from wait4() */
+  JobState state;           /* Process state */
+  struct rusage usage;      /* Resource usage once JOB_DONE */
+  struct timespec finished; /* CLOCK_MONOTONIC time it was reaped */
+} JobProcess;
+
 /* Job structure */
 typedef struct {
-  int job_id;       /* Job ID */
-  pid_t pgid;       /* Process group ID */
-  char *command;    /* Command string */
-  JobState state;   /* Job state */
+  int job_id;         /* Job ID */
+  pid_t pgid;         /* Process group ID */
+  char *command;      /* Command string (NULL until shown) */
+  JobState state;     /* Job state, derived from the processes */
+  int exit_status;    /* Exit status once JOB_DONE */
+  JobProcess *procs;  /* Member processes in pipeline order */
+  int proc_count;     /* Number of member processes */
+  int proc_cap;       /* Allocated process slots */
+  int token;          /* Jobserver slot held (JOB_TOKEN_* or token byte) */
+  int quiet;          /* Process substitution: not listed or announced */
   int saved_stdin;  /* Saved stdin for fg/bg */
   int saved_stdout; /* Saved stdout for fg/bg */
   int saved_stderr; /* Saved stderr for fg/bg */
 } Job;
 
+/* Start point of a time measurement */
+typedef struct {
+  struct timespec wall; /* CLOCK_MONOTONIC */
+  struct rusage usage;  /* Shell's own usage (RUSAGE_SELF) */
+  struct rusage reaped; /* Children reaped so far (RUSAGE_CHILDREN) */
+} TimeMark;
+
+/* Resource usage of one pipeline stage (time keyword) */
+typedef struct {
+  const char *name; /* Command name */
+  double real;      /* Wall clock seconds */
+  double user;      /* User CPU seconds */
+  double sys;       /* System CPU seconds */
+  long maxrss;      /* Peak resident set size (KiB) */
+  long nvcsw;       /* Voluntary context switches */
+  long nivcsw;      /* Involuntary context switches */
+} StageTime;
+
+#define JOB_TOKEN_NONE -1      /* Holds no jobserver slot */
+#define JOB_TOKEN_IMPLICIT 256 /* Holds the shell's implicit slot */
+#define JOB_TOKEN_INTERRUPTED -2 /* Ctrl-C while waiting: start nothing */
+
+/* Arena allocator */
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct {
+  unsigned long allocs;        /* Allocations served */
+  unsigned long bytes;         /* Bytes served */
+  unsigned long chunk_mallocs; /* Chunks obtained from malloc() */
+  unsigned long resets;        /* Resets (one per command line) */
+} ArenaStats;
+
+typedef struct {
+  ArenaChunk *head; /* Current chunk, older chunks chained behind */
+  ArenaStats stats; /* Allocation counters */
+} Arena;
+
+/* Tab completion candidates */
+typedef struct {
+  char **matches; /* Whole words, unquoted; directories end in / */
+  int count;      /* Number of matches */
+  int cap;        /* Allocated slots */
+  size_t start;   /* Where the completed word starts in the line */
+} Completion;
+
+/* Line input source (script file, -c string or stream) */
+typedef struct {
+  const char *data;  /* In-memory input (mapped file or string) */
+  size_t size;       /* Size of data */
+  size_t pos;        /* Read position in data */
+  int mapped;        /* data is an mmap'd file */
+  int owned;         /* data was malloc'd */
+  FILE *stream;      /* Stream input (its descriptor is read directly) */
+  char *stream_buf;  /* Last line read from the stream */
+  size_t stream_cap; /* Allocated size of stream_buf */
+  char *line;        /* Current logical line */
+  size_t line_len;   /* Length of current logical line */
+  size_t line_cap;   /* Allocated size of line */
+  size_t scan_pos;   /* Quote scan position for continuation lines */
+  char scan_quote;   /* Open quote at scan_pos */
+} InputSource;
+
+/* Built-in command table entry */
+typedef struct {
+  const char *name;            /* Command name */
+  int (*func)(char **argv);    /* Implementation */
+  int (*accepts)(char **argv); /* Optional: 0 defers to the external binary */
+  int flags;                   /* BUILTIN_* flags */
+} Builtin;
+
+#define BUILTIN_STATEFUL 0x1 /* Changes shell state; forked in pipelines */
+#define BUILTIN_DISABLED 0x2 /* Turned off with enable -n */
+#define BUILTIN_BLOCKING 0x4 /* Reads stdin or waits; forked if interactive */
+
 /* Global shell state */
 typedef struct {
-  Job jobs[MAX_JOBS];          /* Jobs table */
+  Job **jobs;                  /* Job table, indexed by job_id - 1 */
+  int job_cap;                 /* Slots in the job table */
   int job_count;               /* Number of active jobs */
   pid_t shell_pgid;            /* Shell process group ID */
+  pid_t shell_pid;             /* The shell itself, not a forked copy */
   int shell_terminal;          /* Shell's controlling terminal */
   int is_interactive;          /* Interactive mode flag */
   struct termios shell_tmodes; /* Shell terminal modes */
+  int use_spawn;               /* Launch via posix_spawn (set -o spawn) */
+  int noexec;                  /* -n: parse commands without running them */
+  int held_fds[2];             /* In-shell stage's pipe ends, closed in forks */
+  int exec_tail;               /* Subshell: exec its last command in place */
+  int in_subshell;             /* Forked copy: exit leaves with _exit() */
+  int jobserver_slots;         /* set -o jobserver=N (0: not a server) */
+  int pipe_size;               /* set -o pipesize=N (0: kernel default) */
+  int glob_sort;               /* set -o globsort (off: directory order) */
+  int line_edit;               /* set -o edit: interactive line editor */
+  int last_status;             /* Exit status of last pipeline ($?) */
+  char *arg0;                  /* Shell or script name ($0) */
+  char **pos_args;             /* Positional parameters ($1...) */
+  int pos_count;               /* Number of positional parameters ($#) */
+  Arena arena;                 /* Per-line tokens and pipeline AST */
+  int sigchld_fd;              /* signalfd for the blocked SIGCHLD */
+  int event_fd;                /* epoll set the shell waits on */
+  pid_t event_pid;             /* Process that created event_fd */
 } ShellState;
 
 /* Global shell state instance */
 extern ShellState g_shell;
 
+/* Arena functions */
+void arena_init(Arena *a);
+void *arena_alloc(Arena *a, size_t size);
+void *arena_calloc(Arena *a, size_t n, size_t size);
+char *arena_strdup(Arena *a, const char *s);
+char *arena_strndup(Arena *a, const char *s, size_t len);
+void arena_reset(Arena *a);
+void arena_destroy(Arena *a);
+
 /* Lexer functions */
-char **tokenize(const char *line, int *token_count);
-void free_tokens(char **tokens, int count);
+int tokenize(char *line, TokenList *list, Arena *arena);
+
+/* Expansion functions */
+char *unquote_word(const char *raw, size_t len, Arena *arena);
+int expand_braces(TokenList *list, const char *line, Arena *arena);
+int expand_pipeline(Pipeline *pipeline, Arena *arena);
+
+/* Pathname expansion functions */
+int is_glob_pattern(const char *pattern);
+int glob_expand(const char *pattern, char ***paths, Arena *arena);
+void glob_cache_reset(void);
 
 /* Parser functions */
-Pipeline *parse_pipeline(char **tokens, int token_count);
-void free_pipeline(Pipeline *pipeline);
+CommandList *parse_list(TokenList *list, Arena *arena);
 
 /* Executor functions */
+int execute_list(CommandList *list);
 int execute_pipeline(Pipeline *pipeline);
+int set_pipe_size(const char *arg);
 int execute_command(Command *cmd, int is_pipe, int in_fd, int out_fd);
+void exec_external(Command *cmd, const char *path);
+pid_t launch_process(Command *cmd, pid_t pgid, int in_fd, int out_fd,
+                     int close_fd, int foreground);
+void exec_in_place(Command *cmd);
+pid_t fork_line(const char *line, pid_t pgid, int in_fd, int out_fd,
+                int close_fd);
+
+/* Command hash functions */
+const char *hash_lookup(const char *name);
+void hash_forget(const char *name);
+void hash_clear(void);
+
+/* Shell variable functions */
+void vars_init(void);
+int is_var_name(const char *name, size_t len);
+const char *var_lookup(const char *name, size_t len);
+const char *var_get(const char *name);
+int var_set(const char *name, const char *value, int export);
+int var_export(const char *name);
+int var_unset(const char *name);
+char **var_environ(void);
+int is_assignment(const char *word);
+int assign_variables(char **argv);
 
 /* Redirection functions */
 int setup_redirections(Redirection *redirs, int count, int *saved_fds);
 void restore_redirections(int *saved_fds, int count);
 
+/* Process substitution functions */
+int open_proc_subs(Pipeline *pipeline, Arena *arena);
+void close_proc_subs(Pipeline *pipeline);
+
+/* Here-document functions */
+int read_here_docs(Pipeline *pipeline, InputSource *in, Arena *arena);
+int open_here_docs(Pipeline *pipeline);
+void close_here_docs(Pipeline *pipeline);
+
 /* Job control functions */
 void init_jobs(void);
-int add_job(pid_t pgid, const char *command, JobState state);
+Job *add_job(pid_t pgid, const pid_t *pids, int count, const char *command,
+             JobState state);
 void remove_job(int job_id);
 Job *get_job(int job_id);
+Job *find_job_by_pid(pid_t pid);
 Job *find_job_by_pgid(pid_t pgid);
-void update_job_state(pid_t pgid, JobState state);
+Job *find_last_job(int stopped_only);
+Job *update_process_status(pid_t pid, int status, const struct rusage *ru);
+int wait_for_job(Job *job);
 void list_jobs(void);
 int bring_job_to_foreground(int job_id, int cont);
 int send_job_to_background(int job_id, int cont);
+void notify_jobs(void);
+int wait_job(int job_id);
+int wait_any_job(void);
+
+/* wait_job()/wait_any_job(): Ctrl-C ended the wait, as sh's wait does */
+#define WAIT_INTERRUPTED (128 + SIGINT)
+
+/* Make jobserver functions */
+void jobserver_init(void);
+int jobserver_start(int slots);
+void jobserver_stop(void);
+int jobserver_active(void);
+int jobserver_acquire(void);
+void jobserver_release(int token);
+
+/* Timing functions (time keyword) */
+void time_mark(TimeMark *m);
+double time_elapsed(const TimeMark *start);
+void time_stage_self(StageTime *st, const char *name, const TimeMark *start);
+void time_stage_child(StageTime *st, const char *name, const JobProcess *p,
+                      const TimeMark *start);
+void time_report(const StageTime *stages, int count, double real, int posix);
+
+/* Tracing functions (SEAL_TRACE) */
+extern int g_trace;
+void trace_open(const char *path);
+void trace_close(void);
+void trace_flush(void);
+void trace_after_fork(void);
+uint64_t trace_clock(void);
+void trace_span(const char *name, uint64_t start, const char *detail,
+                pid_t tid);
+
+/* Span hooks: a single branch when tracing is off */
+static inline uint64_t trace_begin(void) {
+  return g_trace ? trace_clock() : 0;
+}
+
+static inline void trace_end(const char *name, uint64_t start,
+                             const char *detail) {
+  if (g_trace)
+    trace_span(name, start, detail, 0);
+}
 
 /* Signal handling functions */
 void setup_signals(void);
+void reap_children(void);
+void ensure_event_set(void);
+int wait_for_child_event(int timeout_ms);
+int wait_for_child_or_interrupt(void);
 void block_signals(void);
 void unblock_signals(void);
 
 /* Built-in commands */
-int is_builtin(const char *cmd);
+const Builtin *find_builtin(const char *cmd);
+const Builtin *lookup_builtin(char **argv);
+const char *builtin_name(int index);
 int execute_builtin(Command *cmd);
 int builtin_cd(char **argv);
 int builtin_exit(char **argv);
@@ -118,14 +410,61 @@ int builtin_fg(char **argv);
 int builtin_bg(char **argv);
 int builtin_help(char **argv);
 int builtin_export(char **argv);
+int builtin_unset(char **argv);
+int builtin_hash(char **argv);
+int builtin_set(char **argv);
+int builtin_memstats(char **argv);
+int builtin_enable(char **argv);
+int builtin_wait(char **argv);
+int builtin_parallel(char **argv);
+int builtin_history(char **argv);
+
+/* Built-in utilities */
+int builtin_echo(char **argv);
+int builtin_printf(char **argv);
+int builtin_test(char **argv);
+int builtin_true(char **argv);
+int builtin_false(char **argv);
+int builtin_pwd(char **argv);
+int builtin_cat(char **argv);
+int builtin_tee(char **argv);
+int true_accepts(char **argv);
+int echo_accepts(char **argv);
+int printf_accepts(char **argv);
+int test_accepts(char **argv);
+int pwd_accepts(char **argv);
+int cat_accepts(char **argv);
+int tee_accepts(char **argv);
+
+/* History functions */
+void history_init(void);
+void history_close(void);
+void history_add(const char *line);
+int history_count(void);
+const char *history_entry(int n, size_t *len);
+int history_search(const char *needle, int before);
+
+/* Line editor and completion */
+const char *edit_line(const char *prompt, size_t *len);
+int complete_line(const char *line, size_t cursor, Completion *comp);
+void complete_free(Completion *comp);
+
+/* Input functions */
+int input_open_file(InputSource *in, const char *path);
+void input_open_string(InputSource *in, const char *str);
+void input_open_stream(InputSource *in, FILE *stream);
+char *input_read_line(InputSource *in);
+const char *input_read_raw(InputSource *in, size_t *len);
+void input_close(InputSource *in);
 
 /* Utility functions */
 char *trim(char *str);
+int write_all(int fd, const char *buf, size_t len);
 void print_error(const char *msg);
-void print_prompt(void);
 
 /* Shell initialization */
-void init_shell(void);
+void init_shell(int allow_interactive);
 void cleanup_shell(void);
+int run_line(char *line, InputSource *in);
 
 #endif /* SHELL_H */
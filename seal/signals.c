@@ -1,43 +1,169 @@
 #include "shell.h"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
-static void sigchld_handler(int sig) {
+/*
+ * Child lifecycle events.
+ *
+ * SIGCHLD stays blocked in the shell and is read from a signalfd that is
+ * registered with an epoll set. Nothing runs in signal context: children
+ * are reaped by reap_children() at safe points (before each command line,
+ * inside wait), so it can never steal a status from the blocking
+ * waitpid(-pgid) loops that wait for foreground jobs.
+ */
+
+void setup_signals(void) {
+  sigset_t mask;
+  struct epoll_event ev;
+
+  g_shell.event_pid = getpid();
+
+  /* Route SIGCHLD to a descriptor instead of a handler */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+    perror("sigprocmask");
+    exit(1);
+  }
+
+  g_shell.sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (g_shell.sigchld_fd < 0) {
+    perror("signalfd");
+    exit(1);
+  }
+
+  g_shell.event_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (g_shell.event_fd < 0) {
+    perror("epoll_create1");
+    exit(1);
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = g_shell.sigchld_fd;
+  if (epoll_ctl(g_shell.event_fd, EPOLL_CTL_ADD, g_shell.sigchld_fd, &ev) <
+      0) {
+    perror("epoll_ctl");
+    exit(1);
+  }
+}
+
+/* Drain pending SIGCHLD notifications. Returns 1 if there were any. */
+static int drain_sigchld(void) {
+  struct signalfd_siginfo info[8];
+  int pending = 0;
+  ssize_t n;
+
+  while ((n = read(g_shell.sigchld_fd, info, sizeof(info))) > 0) {
+    pending = 1;
+  }
+
+  return pending;
+}
+
+void reap_children(void) {
+  struct rusage ru;
   pid_t pid;
   int status;
 
-  /* Reap all terminated/stopped children */
-  while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-    Job *job = find_job_by_pgid(pid);
-
-    if (job) {
-      if (WIFEXITED(status) || WIFSIGNALED(status)) {
-        /* Job terminated */
-        job->state = JOB_DONE;
-        if (g_shell.is_interactive) {
-          printf("\n[%d]+ Done\t\t%s\n", job->job_id, job->command);
-        }
-        /* Will be removed on next cleanup */
-      } else if (WIFSTOPPED(status)) {
-        /* Job stopped */
-        job->state = JOB_STOPPED;
-      } else if (WIFCONTINUED(status)) {
-        /* Job continued */
-        job->state = JOB_RUNNING;
-      }
-    }
+  if (!drain_sigchld())
+    return;
+
+  /* Reap all terminated/stopped/continued children */
+  while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) >
+         0) {
+    /* Job state is reported by notify_jobs() */
+    update_process_status(pid, status, &ru);
   }
 }
 
-void setup_signals(void) {
+/*
+ * A forked copy of the shell (a builtin pipeline stage) shares the epoll
+ * set, but signalfd wakeups only reach the process that registered it.
+ * Give the copy a set of its own before it waits on it.
+ */
+void ensure_event_set(void) {
+  if (g_shell.event_pid != getpid()) {
+    close(g_shell.event_fd);
+    close(g_shell.sigchld_fd);
+    setup_signals();
+  }
+}
+
+/*
+ * Block until a child changes state. Returns 1 on an event, 0 on timeout
+ * (timeout_ms < 0 waits forever) and -1 on error.
+ */
+int wait_for_child_event(int timeout_ms) {
+  struct epoll_event ev;
+  int n;
+
+  ensure_event_set();
+
+  do {
+    n = epoll_wait(g_shell.event_fd, &ev, 1, timeout_ms);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) {
+    perror("epoll_wait");
+    return -1;
+  }
+
+  return n > 0;
+}
+
+/*
+ * Block until a child changes state or another descriptor in the epoll
+ * set is ready, as wait_for_child_event(-1), but let Ctrl-C end the wait
+ * in a shell that ignores SIGINT (an interactive one). The signal is
+ * blocked for the wait, which keeps it pending although it is ignored,
+ * and read from a signalfd of its own. Where SIGINT is not ignored it
+ * still terminates the process. Returns 1 on an event, 0 on SIGINT and
+ * -1 on error.
+ */
+int wait_for_child_or_interrupt(void) {
+  struct epoll_event ev;
   struct sigaction sa;
+  sigset_t mask, old_mask;
+  int n;
 
-  /* Setup SIGCHLD handler */
-  sa.sa_handler = sigchld_handler;
-  sigemptyset(&sa.sa_mask);
-  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-  if (sigaction(SIGCHLD, &sa, NULL) < 0) {
-    perror("sigaction");
-    exit(1);
+  if (sigaction(SIGINT, NULL, &sa) < 0 || sa.sa_handler != SIG_IGN)
+    return wait_for_child_event(-1);
+
+  ensure_event_set();
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigprocmask(SIG_BLOCK, &mask, &old_mask);
+  int int_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (int_fd < 0) {
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return wait_for_child_event(-1);
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = int_fd;
+  epoll_ctl(g_shell.event_fd, EPOLL_CTL_ADD, int_fd, &ev);
+
+  do {
+    n = epoll_wait(g_shell.event_fd, &ev, 1, -1);
+  } while (n < 0 && errno == EINTR);
+
+  int interrupted = 0;
+  struct signalfd_siginfo info;
+  while (read(int_fd, &info, sizeof(info)) > 0)
+    interrupted = 1;
+
+  epoll_ctl(g_shell.event_fd, EPOLL_CTL_DEL, int_fd, NULL);
+  close(int_fd);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  if (n < 0) {
+    perror("epoll_wait");
+    return -1;
   }
+  return interrupted ? 0 : 1;
 }
 
 void block_signals(void) {
@@ -52,7 +178,6 @@ void block_signals(void) {
 void unblock_signals(void) {
   sigset_t mask;
   sigemptyset(&mask);
-  sigaddset(&mask, SIGCHLD);
   sigaddset(&mask, SIGINT);
   sigaddset(&mask, SIGTSTP);
   sigprocmask(SIG_UNBLOCK, &mask, NULL);
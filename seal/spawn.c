@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <spawn.h>
+
+/*
+ * Process launcher.
+ *
+ * External commands are started with posix_spawn() when possible. glibc
+ * implements it with clone(CLONE_VM | CLONE_VFORK), so the cost of
+ * starting a child does not grow with the shell's memory size the way
+ * fork() does. Anything posix_spawn() cannot express goes through the
+ * classic fork()/exec path, which is also selectable at runtime with
+ * "set +o spawn" or SEAL_SPAWN=fork.
+ */
+
+/* glibc 2.35 can hand the terminal to the child's process group */
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
+
+extern char **environ;
+
+static pid_t fork_process(Command *cmd, const char *path,
+                          const Builtin *builtin, pid_t pgid, int in_fd,
+                          int out_fd, int close_fd, int foreground) {
+  uint64_t t = trace_begin();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return -1;
+  }
+
+  if (pid == 0) {
+    /* Child process */
+    trace_after_fork();
+    t = trace_begin();
+
+    /* Set process group (first command creates group) */
+    if (pgid == 0) {
+      pgid = getpid();
+    }
+    setpgid(0, pgid);
+
+    /* A builtin or group that runs exit here ends only this copy */
+    g_shell.in_subshell = 1;
+
+    /* Restore default signal handlers, give terminal to foreground jobs */
+    if (g_shell.is_interactive) {
+      if (foreground) {
+        tcsetpgrp(g_shell.shell_terminal, pgid);
+      }
+      signal(SIGINT, SIG_DFL);
+      signal(SIGQUIT, SIG_DFL);
+      signal(SIGTSTP, SIG_DFL);
+      signal(SIGTTIN, SIG_DFL);
+      signal(SIGTTOU, SIG_DFL);
+    }
+    signal(SIGPIPE, SIG_DFL);
+
+    /* The shell keeps SIGCHLD blocked for its signalfd */
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+
+    /* Setup pipe input */
+    if (in_fd >= 0) {
+      dup2(in_fd, STDIN_FILENO);
+      close(in_fd);
+    }
+
+    /* Setup pipe output */
+    if (out_fd >= 0) {
+      dup2(out_fd, STDOUT_FILENO);
+      close(out_fd);
+    }
+
+    if (close_fd >= 0) {
+      close(close_fd);
+    }
+
+    /* This command's process substitutions must survive the exec */
+    for (int i = 0; i < cmd->procsub_count; i++) {
+      if (cmd->procsubs[i].fd >= 0)
+        fcntl(cmd->procsubs[i].fd, F_SETFD, 0);
+    }
+
+    /* Close-on-exec doesn't help a builtin child, which never execs */
+    for (int i = 0; i < 2; i++) {
+      if (g_shell.held_fds[i] > STDERR_FILENO)
+        close(g_shell.held_fds[i]);
+    }
+
+    /* Setup redirections (nothing to restore in a child) */
+    if (setup_redirections(cmd->redirs, cmd->redir_count, NULL) < 0) {
+      _exit(1);
+    }
+
+    /* Builtin stage running in its own process */
+    if (builtin) {
+      int status = builtin->func(cmd->argv);
+      fflush(stdout);
+      if (g_trace)
+        trace_flush();
+      _exit(status < 0 ? 1 : status);
+    }
+
+    /*
+     * Subshell, or a brace group that has to leave the shell: this copy
+     * runs the list with no terminal of its own, and may exec its last
+     * command in place
+     */
+    if (cmd->group) {
+      g_shell.is_interactive = 0;
+      g_shell.exec_tail = 1;
+      execute_list(cmd->group);
+      fflush(stdout);
+      if (g_trace)
+        trace_flush();
+      _exit(g_shell.last_status);
+    }
+
+    /* Child side of the launch, up to execve() */
+    if (g_trace) {
+      trace_span("child_setup", t, cmd->argv[0], getpid());
+      trace_flush();
+    }
+
+    /* Execute command */
+    exec_external(cmd, path);
+  }
+
+  trace_end("fork", t, cmd->argv[0]);
+
+  /* Parent: set the group here too, whichever side runs first wins */
+  setpgid(pid, pgid ? pgid : pid);
+
+  return pid;
+}
+
+static int add_redirection_actions(posix_spawn_file_actions_t *fa,
+                                   Redirection *redirs, int count) {
+  int ret = 0;
+
+  for (int i = 0; i < count && ret == 0; i++) {
+    Redirection *r = &redirs[i];
+
+    switch (r->type) {
+    case REDIR_IN:
+      ret = posix_spawn_file_actions_addopen(fa, STDIN_FILENO, r->filename,
+                                             O_RDONLY, 0);
+      break;
+    case REDIR_OUT:
+      ret = posix_spawn_file_actions_addopen(
+          fa, STDOUT_FILENO, r->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      break;
+    case REDIR_APPEND:
+      ret = posix_spawn_file_actions_addopen(
+          fa, STDOUT_FILENO, r->filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+      break;
+    case REDIR_ERR:
+      ret = posix_spawn_file_actions_addopen(
+          fa, STDERR_FILENO, r->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      break;
+    case REDIR_ERR_OUT:
+      ret = posix_spawn_file_actions_adddup2(fa, STDOUT_FILENO, STDERR_FILENO);
+      break;
+    case REDIR_HEREDOC:
+    case REDIR_HEREDOC_STRIP:
+    case REDIR_HERESTRING:
+      ret = posix_spawn_file_actions_adddup2(fa, r->fd, STDIN_FILENO);
+      break;
+    default:
+      break;
+    }
+  }
+
+  return ret;
+}
+
+/*
+ * Returns 0 and stores the child pid on success, or an errno value when
+ * the spawn could not be set up or failed (the caller then falls back to
+ * fork, which reports the precise error from inside the child).
+ */
+static int spawn_process(Command *cmd, const char *path, pid_t pgid,
+                         int in_fd, int out_fd, int close_fd, int foreground,
+                         pid_t *pid_out) {
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t fa;
+  sigset_t mask;
+  short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK;
+  int ret;
+
+  if ((ret = posix_spawnattr_init(&attr)) != 0)
+    return ret;
+  if ((ret = posix_spawn_file_actions_init(&fa)) != 0) {
+    posix_spawnattr_destroy(&attr);
+    return ret;
+  }
+
+  /* Join (or create, when pgid is 0) the pipeline's process group */
+  posix_spawnattr_setpgroup(&attr, pgid);
+
+  /* Children start with nothing blocked */
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+
+  /*
+   * Undo the job-control signal dispositions of an interactive shell, and
+   * SIGPIPE, which is ignored while a builtin stage writes to a pipe.
+   */
+  sigaddset(&mask, SIGPIPE);
+  if (g_shell.is_interactive) {
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGTTIN);
+    sigaddset(&mask, SIGTTOU);
+  }
+  posix_spawnattr_setsigdefault(&attr, &mask);
+  flags |= POSIX_SPAWN_SETSIGDEF;
+  posix_spawnattr_setflags(&attr, flags);
+
+#ifdef HAVE_SPAWN_TCSETPGRP
+  if (foreground && g_shell.is_interactive) {
+    ret = posix_spawn_file_actions_addtcsetpgrp_np(&fa, g_shell.shell_terminal);
+  }
+#else
+  (void)foreground;
+#endif
+
+  /* Pipe ends first, then the command's own redirections */
+  if (ret == 0 && in_fd >= 0) {
+    ret = posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+    if (ret == 0)
+      ret = posix_spawn_file_actions_addclose(&fa, in_fd);
+  }
+  if (ret == 0 && out_fd >= 0) {
+    ret = posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO);
+    if (ret == 0)
+      ret = posix_spawn_file_actions_addclose(&fa, out_fd);
+  }
+  if (ret == 0 && close_fd >= 0) {
+    ret = posix_spawn_file_actions_addclose(&fa, close_fd);
+  }
+  if (ret == 0) {
+    ret = add_redirection_actions(&fa, cmd->redirs, cmd->redir_count);
+  }
+
+  /* dup2 onto itself clears close-on-exec for a process substitution */
+  for (int i = 0; ret == 0 && i < cmd->procsub_count; i++) {
+    if (cmd->procsubs[i].fd >= 0)
+      ret = posix_spawn_file_actions_adddup2(&fa, cmd->procsubs[i].fd,
+                                             cmd->procsubs[i].fd);
+  }
+
+  /* Returns once the child has exec'd (CLONE_VFORK) */
+  if (ret == 0) {
+    uint64_t t = trace_begin();
+    ret = posix_spawn(pid_out, path, &fa, &attr, cmd->argv, environ);
+    trace_end("posix_spawn", t, cmd->argv[0]);
+  }
+
+  posix_spawn_file_actions_destroy(&fa);
+  posix_spawnattr_destroy(&attr);
+
+  return ret;
+}
+
+pid_t launch_process(Command *cmd, pid_t pgid, int in_fd, int out_fd,
+                     int close_fd, int foreground) {
+  /* Don't let the child inherit (or reorder) buffered shell output */
+  fflush(stdout);
+
+  /* Rebuild the environment once here, not in every child */
+  var_environ();
+
+  /* Builtins that must not run in the shell and groups get a forked child */
+  const Builtin *builtin = cmd->group ? NULL : lookup_builtin(cmd->argv);
+  if (builtin || cmd->group) {
+    return fork_process(cmd, NULL, builtin, pgid, in_fd, out_fd, close_fd,
+                        foreground);
+  }
+
+  /* Resolve the command in the parent so the hash table persists */
+  const char *path = hash_lookup(cmd->argv[0]);
+
+  int use_spawn = g_shell.use_spawn && path != NULL;
+#ifndef HAVE_SPAWN_TCSETPGRP
+  /* Without tcsetpgrp support only fork can hand over the terminal */
+  if (foreground && g_shell.is_interactive)
+    use_spawn = 0;
+#endif
+
+  if (use_spawn) {
+    pid_t pid;
+    int ret = spawn_process(cmd, path, pgid, in_fd, out_fd, close_fd,
+                            foreground, &pid);
+    if (ret == 0)
+      return pid;
+
+    /* The hashed binary is gone: forget it and search PATH again */
+    if (ret == ENOENT && path != cmd->argv[0]) {
+      hash_forget(cmd->argv[0]);
+      path = hash_lookup(cmd->argv[0]);
+      if (path && spawn_process(cmd, path, pgid, in_fd, out_fd, close_fd,
+                                foreground, &pid) == 0)
+        return pid;
+    }
+  }
+
+  return fork_process(cmd, path, NULL, pgid, in_fd, out_fd, close_fd,
+                      foreground);
+}
+
+/*
+ * Turn this process (the last command of a subshell) into cmd, rather
+ * than forking a child just to wait for it. Does not return.
+ */
+void exec_in_place(Command *cmd) {
+  sigset_t empty;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  /* Waiting inside the subshell may have blocked SIGCHLD again */
+  sigemptyset(&empty);
+  sigprocmask(SIG_SETMASK, &empty, NULL);
+
+  for (int i = 0; i < cmd->procsub_count; i++) {
+    if (cmd->procsubs[i].fd >= 0)
+      fcntl(cmd->procsubs[i].fd, F_SETFD, 0);
+  }
+
+  if (setup_redirections(cmd->redirs, cmd->redir_count, NULL) < 0) {
+    _exit(1);
+  }
+
+  if (g_trace)
+    trace_flush();
+
+  exec_external(cmd, hash_lookup(cmd->argv[0]));
+}
+
+/*
+ * Run a whole command line in a forked copy of the shell, in process
+ * group pgid (0: its own). in_fd/out_fd (-1: inherit) become its
+ * stdin/stdout and close_fd is closed in the copy.
+ */
+pid_t fork_line(const char *line, pid_t pgid, int in_fd, int out_fd,
+                int close_fd) {
+  fflush(stdout);
+
+  pid_t pid = fork();
+  if (pid != 0) {
+    if (pid < 0)
+      perror("fork");
+    else
+      setpgid(pid, pgid ? pgid : pid);
+    return pid;
+  }
+
+  sigset_t empty;
+  trace_after_fork();
+  setpgid(0, pgid);
+  signal(SIGPIPE, SIG_DFL);
+  if (g_shell.is_interactive) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+  }
+  sigemptyset(&empty);
+  sigprocmask(SIG_SETMASK, &empty, NULL);
+
+  /*
+   * The copy never owns the terminal and reaps its own children. Like a
+   * subshell it execs its last command in place, which also keeps that
+   * command in pgid.
+   */
+  g_shell.is_interactive = 0;
+  g_shell.in_subshell = 1;
+  g_shell.exec_tail = 1;
+
+  if (in_fd >= 0)
+    dup2(in_fd, STDIN_FILENO);
+  if (out_fd >= 0)
+    dup2(out_fd, STDOUT_FILENO);
+  if (close_fd >= 0)
+    close(close_fd);
+
+  char *copy = strdup(line);
+  if (copy)
+    run_line(copy, NULL);
+  fflush(stdout);
+  if (g_trace)
+    trace_flush();
+  _exit(g_shell.last_status);
+}
@@ -0,0 +1,85 @@
+#!/bin/bash
+# Seal regression tests
+#
+# usage: tests/test_runner.sh [seal-binary]
+#
+# Each test runs a command line with seal -c and compares its output
+# (stdout and stderr) with the expected text; background job lines
+# ("[1] 1234") are left out, since they carry a pid. Prints one line per
+# failure and a summary; exits 1 if any test failed.
+
+set -uo pipefail
+
+SEAL=${1:-./seal}
+
+SEAL=$(cd "$(dirname "$SEAL")" && pwd)/$(basename "$SEAL")
+if [ ! -x "$SEAL" ]; then
+  echo "test: $SEAL: not executable (run make first)" >&2
+  exit 2
+fi
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/seal-test.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+passed=0
+failed=0
+
+# check NAME EXPECTED LINE: run LINE and compare its output with EXPECTED
+check() {
+  local name=$1 expected=$2 line=$3
+  local actual
+  actual=$("$SEAL" -c "$line" 2>&1 | grep -Ev '^\[[0-9]+\] [0-9]+$')
+  if [ "$actual" == "$expected" ]; then
+    passed=$((passed + 1))
+  else
+    failed=$((failed + 1))
+    echo "FAIL $name"
+    echo "  expected: $(printf '%q' "$expected")"
+    echo "  actual:   $(printf '%q' "$actual")"
+  fi
+}
+
+# exit in a forked copy of the shell ends only that copy
+check subshell-exit-status "3" \
+  '( exit 3 ); echo $?'
+check subshell-exit-keeps-jobs "0" \
+  'sleep 0.2 >/dev/null & ( exit 3 ); wait %1; echo $?'
+check stage-exit-keeps-jobs "0" \
+  'sleep 0.2 >/dev/null & { exit 0; } | cat; wait %1; echo $?'
+
+# & puts the whole AND-OR list before it in the background
+check and-or-background-status "0" \
+  'false && echo no & echo $?; wait'
+check and-or-background-job "$(printf '[1]  Running\t\tsleep && true')" \
+  'sleep 0.2 && true & jobs; wait'
+check and-or-background-runs "B
+A" \
+  'sleep 0.2 && echo A > f & echo B; wait; cat f'
+
+# Here-document bodies expand $ unless the delimiter is quoted
+check heredoc-expand "hi there \$X" \
+  'X=hi; cat <<EOF
+$X there \$X
+EOF'
+check heredoc-quoted "\$X there" \
+  "X=hi; cat <<'EOF'
+\$X there
+EOF"
+
+# A builtin stage that reaps children leaves the others' statuses alone
+check parallel-stage-status "5" \
+  "parallel -j1 sleep ::: 0.2 | sh -c 'exit 5'; echo \$?"
+
+# printf reports flags on %% instead of printing nothing
+check printf-flagged-percent "a%
+seal: printf: %5%: invalid conversion specification
+1" \
+  "printf 'a%%\\n%5%b'; echo \$?"
+
+# true and false leave --help to the real binary
+check true-help-external "1" \
+  'true --help | grep -c "^Usage: true"'
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,198 @@
+#include "shell.h"
+#include <ctype.h>
+
+/*
+ * time keyword.
+ *
+ * Child stages are measured with the rusage that wait4() returns when
+ * they are reaped; a builtin stage or brace group that runs inside the
+ * shell is measured as the difference of getrusage(RUSAGE_SELF) around
+ * it, plus the children it reaped in between (RUSAGE_CHILDREN). Wall time comes
+ * from CLOCK_MONOTONIC. The report goes to stderr.
+ */
+
+static double tv_seconds(const struct timeval *tv) {
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static double ts_diff(const struct timespec *start, const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void time_mark(TimeMark *m) {
+  clock_gettime(CLOCK_MONOTONIC, &m->wall);
+  getrusage(RUSAGE_SELF, &m->usage);
+  getrusage(RUSAGE_CHILDREN, &m->reaped);
+}
+
+double time_elapsed(const TimeMark *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ts_diff(&start->wall, &now);
+}
+
+/* Usage of a stage that ran inside the shell since start */
+void time_stage_self(StageTime *st, const char *name, const TimeMark *start) {
+  TimeMark now;
+  time_mark(&now);
+
+  st->name = name;
+  st->real = ts_diff(&start->wall, &now.wall);
+  st->user = tv_seconds(&now.usage.ru_utime) -
+             tv_seconds(&start->usage.ru_utime) +
+             tv_seconds(&now.reaped.ru_utime) -
+             tv_seconds(&start->reaped.ru_utime);
+  st->sys = tv_seconds(&now.usage.ru_stime) -
+            tv_seconds(&start->usage.ru_stime) +
+            tv_seconds(&now.reaped.ru_stime) -
+            tv_seconds(&start->reaped.ru_stime);
+  st->maxrss = now.usage.ru_maxrss;
+  if (now.reaped.ru_maxrss > start->reaped.ru_maxrss &&
+      now.reaped.ru_maxrss > st->maxrss)
+    st->maxrss = now.reaped.ru_maxrss;
+  st->nvcsw = now.usage.ru_nvcsw - start->usage.ru_nvcsw +
+              now.reaped.ru_nvcsw - start->reaped.ru_nvcsw;
+  st->nivcsw = now.usage.ru_nivcsw - start->usage.ru_nivcsw +
+               now.reaped.ru_nivcsw - start->reaped.ru_nivcsw;
+}
+
+/* Usage of a reaped child stage started at start and reaped at end */
+void time_stage_child(StageTime *st, const char *name, const JobProcess *p,
+                      const TimeMark *start) {
+  st->name = name;
+  st->real = ts_diff(&start->wall, &p->finished);
+  st->user = tv_seconds(&p->usage.ru_utime);
+  st->sys = tv_seconds(&p->usage.ru_stime);
+  st->maxrss = p->usage.ru_maxrss;
+  st->nvcsw = p->usage.ru_nvcsw;
+  st->nivcsw = p->usage.ru_nivcsw;
+}
+
+/* Print seconds as %[p][l] does in bash's TIMEFORMAT */
+static void put_seconds(double secs, int precision, int longfmt) {
+  if (longfmt) {
+    int minutes = (int)(secs / 60);
+    fprintf(stderr, "%dm%.*fs", minutes, precision, secs - minutes * 60);
+  } else {
+    fprintf(stderr, "%.*f", precision, secs);
+  }
+}
+
+/*
+ * Expand a TIMEFORMAT string: %[p][l]R, %[p][l]U, %[p][l]S, %P (CPU
+ * percentage), %M (peak RSS in KiB), %w/%c (voluntary/involuntary
+ * context switches) and %%.
+ */
+static void print_format(const char *fmt, const StageTime *total) {
+  const char *p;
+
+  for (p = fmt; *p; p++) {
+    int precision = 3;
+    int longfmt = 0;
+
+    if (*p != '%' || p[1] == '\0') {
+      fputc(*p, stderr);
+      continue;
+    }
+
+    p++;
+    if (isdigit((unsigned char)*p)) {
+      precision = *p - '0';
+      if (precision > 6)
+        precision = 6;
+      p++;
+    }
+    if (*p == 'l') {
+      longfmt = 1;
+      p++;
+    }
+
+    switch (*p) {
+    case 'R':
+      put_seconds(total->real, precision, longfmt);
+      break;
+    case 'U':
+      put_seconds(total->user, precision, longfmt);
+      break;
+    case 'S':
+      put_seconds(total->sys, precision, longfmt);
+      break;
+    case 'P':
+      fprintf(stderr, "%.2f",
+              total->real > 0 ? 100 * (total->user + total->sys) / total->real
+                              : 0.0);
+      break;
+    case 'M':
+      fprintf(stderr, "%ld", total->maxrss);
+      break;
+    case 'w':
+      fprintf(stderr, "%ld", total->nvcsw);
+      break;
+    case 'c':
+      fprintf(stderr, "%ld", total->nivcsw);
+      break;
+    case '%':
+      fputc('%', stderr);
+      break;
+    case '\0':
+      p--;
+      break;
+    default:
+      fputc('%', stderr);
+      fputc(*p, stderr);
+    }
+  }
+  fputc('\n', stderr);
+}
+
+static void print_row(const StageTime *st) {
+  fprintf(stderr, "%9.3fs %9.3fs %9.3fs %9ldk %6ld %6ld  %s\n", st->real,
+          st->user, st->sys, st->maxrss, st->nvcsw, st->nivcsw, st->name);
+}
+
+/*
+ * Print the report for a timed pipeline: one row per stage plus a total
+ * (CPU and context switches summed, peak RSS the largest of any stage),
+ * or just the total formatted by TIMEFORMAT or time -p.
+ */
+void time_report(const StageTime *stages, int count, double real,
+                 int posix) {
+  StageTime total;
+  const char *fmt = var_get("TIMEFORMAT");
+  int i;
+
+  memset(&total, 0, sizeof(total));
+  total.name = "total";
+  total.real = real;
+  for (i = 0; i < count; i++) {
+    total.user += stages[i].user;
+    total.sys += stages[i].sys;
+    total.nvcsw += stages[i].nvcsw;
+    total.nivcsw += stages[i].nivcsw;
+    if (stages[i].maxrss > total.maxrss)
+      total.maxrss = stages[i].maxrss;
+  }
+
+  fflush(stdout);
+
+  if (posix) {
+    fprintf(stderr, "real %.2f\nuser %.2f\nsys %.2f\n", total.real,
+            total.user, total.sys);
+    return;
+  }
+
+  if (fmt) {
+    if (*fmt)
+      print_format(fmt, &total);
+    return;
+  }
+
+  fprintf(stderr, "%10s %10s %10s %10s %6s %6s  %s\n", "real", "user", "sys",
+          "maxrss", "vcsw", "ivcsw", "stage");
+  for (i = 0; i < count; i++) {
+    print_row(&stages[i]);
+  }
+  if (count > 1) {
+    print_row(&total);
+  }
+}
@@ -0,0 +1,140 @@
+#include "shell.h"
+
+/*
+ * Phase tracing (SEAL_TRACE=/path).
+ *
+ * Spans are complete ("ph":"X") events in Chrome trace format, loadable
+ * in chrome://tracing or Perfetto. A path ending in .jsonl gets one bare
+ * JSON object per line instead of the array form. Events are formatted
+ * into a buffer that is written out when full and at exit; the file is
+ * opened O_APPEND so a forked child can add its own events without
+ * interleaving with the shell's.
+ *
+ * When tracing is off every hook is one test of g_trace.
+ */
+
+#define TRACE_BUF_SIZE (64 * 1024)
+#define TRACE_EVENT_MAX 512
+
+int g_trace;
+
+static int trace_fd = -1;
+static int trace_jsonl;
+static pid_t trace_pid;
+static char trace_buf[TRACE_BUF_SIZE];
+static size_t trace_len;
+
+uint64_t trace_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void trace_write(const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(trace_fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+void trace_flush(void) {
+  if (trace_fd >= 0 && trace_len > 0) {
+    trace_write(trace_buf, trace_len);
+  }
+  trace_len = 0;
+}
+
+void trace_open(const char *path) {
+  size_t len = strlen(path);
+
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                  0644);
+  if (trace_fd < 0) {
+    fprintf(stderr, "seal: SEAL_TRACE: %s: %s\n", path, strerror(errno));
+    return;
+  }
+
+  trace_jsonl = (len > 6 && strcmp(path + len - 6, ".jsonl") == 0);
+  trace_pid = getpid();
+  trace_len = 0;
+  g_trace = 1;
+
+  /* Chrome's loader accepts an unterminated array */
+  if (!trace_jsonl)
+    trace_write("[\n", 2);
+}
+
+void trace_close(void) {
+  if (trace_fd < 0)
+    return;
+
+  trace_flush();
+  close(trace_fd);
+  trace_fd = -1;
+  g_trace = 0;
+}
+
+/* A forked child must not write the shell's pending events again */
+void trace_after_fork(void) {
+  trace_len = 0;
+  trace_pid = getppid();
+}
+
+/* Append s to out as the body of a JSON string */
+static size_t json_escape(char *out, size_t cap, const char *s) {
+  size_t n = 0;
+
+  for (; *s && n + 7 < cap; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') {
+      out[n++] = '\\';
+      out[n++] = c;
+    } else if (c < 0x20) {
+      n += snprintf(out + n, cap - n, "\\u%04x", c);
+    } else {
+      out[n++] = c;
+    }
+  }
+  out[n] = '\0';
+  return n;
+}
+
+/*
+ * Record a span from start (trace_clock()) to now. detail, if not NULL,
+ * becomes args.detail; tid 0 means the shell itself.
+ */
+void trace_span(const char *name, uint64_t start, const char *detail,
+                pid_t tid) {
+  char event[TRACE_EVENT_MAX];
+  char esc[256];
+  char args[300] = "";
+  uint64_t end = trace_clock();
+  int n;
+
+  if (trace_fd < 0)
+    return;
+
+  if (detail) {
+    json_escape(esc, sizeof(esc), detail);
+    snprintf(args, sizeof(args), ",\"args\":{\"detail\":\"%s\"}", esc);
+  }
+
+  n = snprintf(event, sizeof(event),
+               "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+               "\"pid\":%d,\"tid\":%d%s}%s\n",
+               name, start / 1000.0, (end - start) / 1000.0, (int)trace_pid,
+               (int)(tid ? tid : trace_pid), args, trace_jsonl ? "" : ",");
+  if (n < 0 || n >= (int)sizeof(event))
+    return;
+
+  if (trace_len + n > sizeof(trace_buf))
+    trace_flush();
+  memcpy(trace_buf + trace_len, event, n);
+  trace_len += n;
+}
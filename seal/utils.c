@@ -22,4 +22,19 @@ char *trim(char *str) {
   return str;
 }
 
+/* write() all of buf, retrying short writes and EINTR */
+int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
 void print_error(const char *msg) { fprintf(stderr, "seal: %s\n", msg); }
@@ -0,0 +1,283 @@
+#include "shell.h"
+#include <ctype.h>
+
+/*
+ * Shell variables.
+ *
+ * Every variable lives in one hash table with an exported flag. Each
+ * entry keeps its "NAME=value" string, so the environment handed to
+ * commands is just an array of pointers to the exported entries. That
+ * array is rebuilt only after an exported variable changes, and environ
+ * points at it, so launching a command never walks or copies the
+ * environment and getenv() agrees with the table.
+ */
+
+#define VARS_INITIAL_BUCKETS 64
+
+extern char **environ;
+
+typedef struct Var {
+  char *entry;      /* "NAME=value" */
+  size_t name_len;  /* Length of NAME */
+  int exported;     /* Passed to commands */
+  struct Var *next; /* Bucket chain */
+} Var;
+
+static Var **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t var_count = 0;
+static size_t exported_count = 0;
+
+/* Environment built from the exported entries */
+static char **env_array = NULL;
+static int env_dirty = 1;
+
+/*
+ * Entries replaced while environ still points at them. They are freed
+ * once the next rebuild has moved environ off them.
+ */
+static char **retired = NULL;
+static size_t retired_count = 0;
+static size_t retired_cap = 0;
+
+static size_t hash_var(const char *name, size_t len) {
+  /* FNV-1a */
+  size_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static Var *find_var(const char *name, size_t len) {
+  if (bucket_count == 0)
+    return NULL;
+
+  Var *v = buckets[hash_var(name, len) & (bucket_count - 1)];
+  while (v) {
+    if (v->name_len == len && memcmp(v->entry, name, len) == 0)
+      return v;
+    v = v->next;
+  }
+  return NULL;
+}
+
+static void grow_table(void) {
+  size_t new_count = bucket_count ? bucket_count * 2 : VARS_INITIAL_BUCKETS;
+  Var **new_buckets = calloc(new_count, sizeof(Var *));
+  if (!new_buckets) {
+    perror("calloc");
+    return;
+  }
+
+  for (size_t i = 0; i < bucket_count; i++) {
+    Var *v = buckets[i];
+    while (v) {
+      Var *next = v->next;
+      size_t idx = hash_var(v->entry, v->name_len) & (new_count - 1);
+      v->next = new_buckets[idx];
+      new_buckets[idx] = v;
+      v = next;
+    }
+  }
+
+  free(buckets);
+  buckets = new_buckets;
+  bucket_count = new_count;
+}
+
+/* Drop an entry; environ may still use it if it was exported */
+static void retire_entry(Var *v) {
+  if (!v->exported || !v->entry) {
+    free(v->entry);
+    return;
+  }
+
+  env_dirty = 1;
+  if (retired_count == retired_cap) {
+    size_t cap = retired_cap ? retired_cap * 2 : 16;
+    char **grown = realloc(retired, cap * sizeof(char *));
+    if (!grown) {
+      /* Leaking the string is safer than freeing it under environ */
+      perror("realloc");
+      return;
+    }
+    retired = grown;
+    retired_cap = cap;
+  }
+  retired[retired_count++] = v->entry;
+}
+
+/* Store name=value; export 1 marks it exported, 0 keeps its flag */
+static int store(const char *name, size_t name_len, const char *value,
+                 int export) {
+  size_t value_len = strlen(value);
+  char *entry = malloc(name_len + value_len + 2);
+  if (!entry) {
+    perror("malloc");
+    return -1;
+  }
+  memcpy(entry, name, name_len);
+  entry[name_len] = '=';
+  memcpy(entry + name_len + 1, value, value_len + 1);
+
+  Var *v = find_var(name, name_len);
+  if (!v) {
+    if (var_count >= bucket_count) {
+      grow_table();
+      if (bucket_count == 0) {
+        free(entry);
+        return -1;
+      }
+    }
+
+    v = calloc(1, sizeof(Var));
+    if (!v) {
+      perror("calloc");
+      free(entry);
+      return -1;
+    }
+    v->name_len = name_len;
+
+    size_t idx = hash_var(name, name_len) & (bucket_count - 1);
+    v->next = buckets[idx];
+    buckets[idx] = v;
+    var_count++;
+  }
+
+  retire_entry(v);
+  v->entry = entry;
+  if (export && !v->exported) {
+    v->exported = 1;
+    exported_count++;
+  }
+  if (v->exported)
+    env_dirty = 1;
+
+  /* Cached command paths are only valid for the old PATH */
+  if (name_len == 4 && memcmp(name, "PATH", 4) == 0)
+    hash_clear();
+
+  return 0;
+}
+
+/* Import the environment the shell was started with */
+void vars_init(void) {
+  for (char **e = environ; *e; e++) {
+    const char *eq = strchr(*e, '=');
+    if (eq && eq != *e)
+      store(*e, eq - *e, eq + 1, 1);
+  }
+}
+
+/* A shell variable name: a letter or _, then letters, digits and _ */
+int is_var_name(const char *name, size_t len) {
+  if (len == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+    return 0;
+  for (size_t i = 1; i < len; i++) {
+    if (!(isalnum((unsigned char)name[i]) || name[i] == '_'))
+      return 0;
+  }
+  return 1;
+}
+
+/* Value of a variable (len bytes of name), or NULL if it is unset */
+const char *var_lookup(const char *name, size_t len) {
+  Var *v = find_var(name, len);
+  return v ? v->entry + v->name_len + 1 : NULL;
+}
+
+const char *var_get(const char *name) {
+  return var_lookup(name, strlen(name));
+}
+
+int var_set(const char *name, const char *value, int export) {
+  return store(name, strlen(name), value, export);
+}
+
+/* Mark a variable exported. An unset one stays unset. */
+int var_export(const char *name) {
+  Var *v = find_var(name, strlen(name));
+  if (v && !v->exported) {
+    v->exported = 1;
+    exported_count++;
+    env_dirty = 1;
+  }
+  return 0;
+}
+
+int var_unset(const char *name) {
+  size_t len = strlen(name);
+  if (bucket_count == 0)
+    return 0;
+
+  Var **link = &buckets[hash_var(name, len) & (bucket_count - 1)];
+  while (*link) {
+    Var *v = *link;
+    if (v->name_len == len && memcmp(v->entry, name, len) == 0) {
+      *link = v->next;
+      retire_entry(v);
+      if (v->exported)
+        exported_count--;
+      free(v);
+      var_count--;
+      if (len == 4 && memcmp(name, "PATH", 4) == 0)
+        hash_clear();
+      return 0;
+    }
+    link = &v->next;
+  }
+  return 0;
+}
+
+/*
+ * The environment for the next command, rebuilt only if an exported
+ * variable changed since the last call. Also installed as environ.
+ */
+char **var_environ(void) {
+  if (!env_dirty)
+    return environ;
+
+  char **array = malloc((exported_count + 1) * sizeof(char *));
+  if (!array) {
+    perror("malloc");
+    return environ;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < bucket_count; i++) {
+    for (Var *v = buckets[i]; v; v = v->next) {
+      if (v->exported)
+        array[n++] = v->entry;
+    }
+  }
+  array[n] = NULL;
+
+  /* Nothing refers to the old array or the replaced entries any more */
+  environ = array;
+  free(env_array);
+  env_array = array;
+  for (size_t i = 0; i < retired_count; i++)
+    free(retired[i]);
+  retired_count = 0;
+  env_dirty = 0;
+
+  return environ;
+}
+
+/* NAME=value with a valid name */
+int is_assignment(const char *word) {
+  const char *eq = strchr(word, '=');
+  return eq && is_var_name(word, eq - word);
+}
+
+/* A command made only of NAME=value words sets shell variables */
+int assign_variables(char **argv) {
+  for (int i = 0; argv[i]; i++) {
+    const char *eq = strchr(argv[i], '=');
+    if (store(argv[i], eq - argv[i], eq + 1, 0) < 0)
+      return 1;
+  }
+  return 0;
+}